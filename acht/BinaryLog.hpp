@@ -0,0 +1,481 @@
+#ifndef _BINARY_LOG_HPP_
+#define _BINARY_LOG_HPP_
+
+#include "LogFormat.hpp"
+#include "LogSink.hpp"
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstring>
+#include <cstdint>
+#include <cstdio>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+namespace acht {
+
+    /***********************************************************
+     *  The binary log format. A file holds one or more sessions,
+     *  each written by one BinaryFileSink; a session starts with
+     *  the 8 bytes of "binary_log_magic" and goes on with entries.
+     *  Every entry starts with a tag byte:
+     *
+     *  Level:  id, name length, name
+     *  Format: id, text length, text
+     *  Record: format id, level id, time delta, argument size,
+     *          arguments
+     *
+     *  Numbers are varints (7 bits a byte, low bits first). A
+     *  level or format is defined once per session, before its
+     *  first use, with ids counting up from 0. The time of a
+     *  record is in nanoseconds since the epoch, written as the
+     *  zigzag-encoded difference to the time of the previous
+     *  record of the session (to 0 for the first one). The
+     *  arguments are kept as the logger encoded them (see
+     *  LogFormat.hpp), except that integers and string lengths
+     *  are varints; nothing is formatted when writing.
+     ***********************************************************/
+    constexpr char binary_log_magic[8] = {'A', 'C', 'H', 'T', 'B', 'L', 'O', 'G'};
+
+    enum class BinaryLogTag : std::uint8_t {
+        Level = 1,
+        Format = 2,
+        Record = 3
+    };
+
+    namespace detail {
+
+        inline void putVarint(std::string& out, std::uint64_t value) {
+            while (value >= 0x80) {
+                out += static_cast<char>(value | 0x80);
+                value >>= 7;
+            }
+            out += static_cast<char>(value);
+        }
+
+        // Read a varint, return false if it runs past "end".
+        inline bool getVarint(const char*& in, const char* end, std::uint64_t& value) {
+            value = 0;
+            for (int shift = 0; shift < 64 && in < end; shift += 7) {
+                std::uint8_t byte = static_cast<std::uint8_t>(*in++);
+                value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+                if ((byte & 0x80) == 0) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        inline std::uint64_t zigzagEncode(std::int64_t value) {
+            return (static_cast<std::uint64_t>(value) << 1) ^ static_cast<std::uint64_t>(value >> 63);
+        }
+
+        inline std::int64_t zigzagDecode(std::uint64_t value) {
+            return static_cast<std::int64_t>(value >> 1) ^ -static_cast<std::int64_t>(value & 1);
+        }
+
+        /***********************************************************
+         *  Append encoded arguments to "out" with their integers
+         *  and string lengths as varints. From an argument of an
+         *  unknown type on, the rest is copied as it is, so that
+         *  expandArgs reports the record as corrupt.
+         ***********************************************************/
+        inline void compactArgs(std::string& out, const char* in, std::size_t size) {
+            const char* end = in + size;
+            while (in < end) {
+                LogArgType type = static_cast<LogArgType>(*in);
+                out += *in++;
+                switch (type) {
+                    case LogArgType::Bool:
+                    case LogArgType::Char:
+                        out += *in++;
+                        break;
+                    case LogArgType::Int:
+                        putVarint(out, zigzagEncode(getRaw<std::int64_t>(in)));
+                        break;
+                    case LogArgType::UInt:
+                    case LogArgType::Pointer:
+                        putVarint(out, getRaw<std::uint64_t>(in));
+                        break;
+                    case LogArgType::Double:
+                        out.append(in, sizeof(double));
+                        in += sizeof(double);
+                        break;
+                    case LogArgType::String: {
+                        std::uint32_t length = getRaw<std::uint32_t>(in);
+                        putVarint(out, length);
+                        out.append(in, length);
+                        in += length;
+                        break;
+                    }
+                    default:
+                        out.append(in, static_cast<std::size_t>(end - in));
+                        return;
+                }
+            }
+        }
+
+        /***********************************************************
+         *  Undo compactArgs. Return false if the arguments are
+         *  malformed.
+         ***********************************************************/
+        inline bool expandArgs(std::string& out, const char* in, const char* end) {
+            char raw[sizeof(std::uint64_t)];
+            while (in < end) {
+                LogArgType type = static_cast<LogArgType>(*in);
+                out += *in++;
+                std::uint64_t value;
+                char* put = raw;
+                switch (type) {
+                    case LogArgType::Bool:
+                    case LogArgType::Char:
+                        if (in == end) {
+                            return false;
+                        }
+                        out += *in++;
+                        continue;
+                    case LogArgType::Int:
+                        if (!getVarint(in, end, value)) {
+                            return false;
+                        }
+                        putRaw(put, zigzagDecode(value));
+                        break;
+                    case LogArgType::UInt:
+                    case LogArgType::Pointer:
+                        if (!getVarint(in, end, value)) {
+                            return false;
+                        }
+                        putRaw(put, value);
+                        break;
+                    case LogArgType::Double:
+                        if (end - in < static_cast<std::ptrdiff_t>(sizeof(double))) {
+                            return false;
+                        }
+                        out.append(in, sizeof(double));
+                        in += sizeof(double);
+                        continue;
+                    case LogArgType::String:
+                        if (!getVarint(in, end, value) || value > static_cast<std::uint64_t>(end - in)) {
+                            return false;
+                        }
+                        putRaw(put, static_cast<std::uint32_t>(value));
+                        out.append(raw, sizeof(std::uint32_t));
+                        out.append(in, static_cast<std::size_t>(value));
+                        in += value;
+                        continue;
+                    default:
+                        return false;
+                }
+                out.append(raw, sizeof(raw));
+            }
+            return true;
+        }
+    }
+
+    /***********************************************************
+     *  Encodes log records in the binary log format, one session.
+     *  Format strings are told apart by their address, so they
+     *  must be string literals, as they are for the logger.
+     ***********************************************************/
+    class BinaryLogEncoder {
+    private:
+        std::unordered_map<const char*, std::uint32_t> format_ids;
+        std::uint32_t level_ids;
+        std::int64_t last_time;
+        bool started;
+        // The compacted arguments of a record.
+        std::string compacted;
+
+    public:
+        BinaryLogEncoder() : level_ids(0), last_time(0), started(false) {}
+
+        /***********************************************************
+         *  Append a record to "out", starting the session and
+         *  defining its format first if needed.
+         ***********************************************************/
+        void encode(std::string& out, LogLevel level, std::int64_t time,
+                    const char* format, const char* args, std::size_t size) {
+            if (!started) {
+                out.append(binary_log_magic, sizeof(binary_log_magic));
+                started = true;
+            }
+            std::uint32_t level_id = static_cast<std::uint32_t>(level);
+            while (level_ids <= level_id) {
+                const char* name = logLevelName(static_cast<LogLevel>(level_ids));
+                out += static_cast<char>(BinaryLogTag::Level);
+                detail::putVarint(out, level_ids);
+                detail::putVarint(out, std::strlen(name));
+                out += name;
+                ++level_ids;
+            }
+            auto found = format_ids.find(format);
+            if (found == format_ids.end()) {
+                std::uint32_t id = static_cast<std::uint32_t>(format_ids.size());
+                found = format_ids.emplace(format, id).first;
+                std::size_t length = std::strlen(format);
+                out += static_cast<char>(BinaryLogTag::Format);
+                detail::putVarint(out, id);
+                detail::putVarint(out, length);
+                out.append(format, length);
+            }
+            out += static_cast<char>(BinaryLogTag::Record);
+            detail::putVarint(out, found->second);
+            detail::putVarint(out, level_id);
+            detail::putVarint(out, detail::zigzagEncode(time - last_time));
+            compacted.clear();
+            detail::compactArgs(compacted, args, size);
+            detail::putVarint(out, compacted.size());
+            out += compacted;
+            last_time = time;
+        }
+    };
+
+    /***********************************************************
+     *  Decodes the binary log format. Feed it the bytes of a file
+     *  in pieces of any size and take the records out with next().
+     ***********************************************************/
+    class BinaryLogDecoder {
+    public:
+        struct Record {
+            const char* level_name;
+            std::int64_t time;
+            const char* format;
+            const char* args;
+            std::size_t size;
+            // The index of the level, 0 (FATAL) for the most severe.
+            std::uint32_t level;
+        };
+
+        enum class Status {
+            Record,
+            // Feed more bytes first.
+            NeedMore,
+            // The bytes are not in the binary log format.
+            Corrupt
+        };
+
+    private:
+        std::string buffer;
+        std::size_t pos;
+        // The bytes fed and dropped from the front of "buffer".
+        std::uint64_t dropped;
+        std::vector<std::string> levels;
+        std::vector<std::string> formats;
+        // The arguments of the last record, as the logger encoded them.
+        std::string args;
+        std::int64_t last_time;
+        bool in_session;
+
+        bool getString(const char*& in, const char* end, std::uint64_t& id, std::string& value) {
+            std::uint64_t length;
+            if (!detail::getVarint(in, end, id) || !detail::getVarint(in, end, length)
+                    || length > static_cast<std::uint64_t>(end - in)) {
+                return false;
+            }
+            value.assign(in, static_cast<std::size_t>(length));
+            in += length;
+            return true;
+        }
+
+    public:
+        BinaryLogDecoder() : pos(0), dropped(0), last_time(0), in_session(false) {}
+
+        // Add the next bytes of the file.
+        void feed(const char* data, std::size_t size) {
+            if (pos > 0 && pos >= buffer.size() / 2) {
+                buffer.erase(0, pos);
+                dropped += pos;
+                pos = 0;
+            }
+            buffer.append(data, size);
+        }
+
+        /***********************************************************
+         *  Decode the next record. The record points into the
+         *  decoder and is valid until the next call to next() or
+         *  feed().
+         ***********************************************************/
+        Status next(Record& record) {
+            while (true) {
+                const char* begin = buffer.data() + pos;
+                const char* end = buffer.data() + buffer.size();
+                const char* in = begin;
+                if (in == end) {
+                    return Status::NeedMore;
+                }
+                if (*in == binary_log_magic[0]) {
+                    // A new session, with new dictionaries
+                    std::size_t length = std::min(sizeof(binary_log_magic), static_cast<std::size_t>(end - in));
+                    if (std::memcmp(in, binary_log_magic, length) != 0) {
+                        return Status::Corrupt;
+                    }
+                    if (length < sizeof(binary_log_magic)) {
+                        return Status::NeedMore;
+                    }
+                    levels.clear();
+                    formats.clear();
+                    last_time = 0;
+                    in_session = true;
+                    pos += sizeof(binary_log_magic);
+                    continue;
+                }
+                if (!in_session) {
+                    return Status::Corrupt;
+                }
+
+                std::uint64_t id;
+                std::string value;
+                switch (static_cast<BinaryLogTag>(*in++)) {
+                    case BinaryLogTag::Level:
+                    case BinaryLogTag::Format: {
+                        bool is_level = static_cast<BinaryLogTag>(*begin) == BinaryLogTag::Level;
+                        if (!getString(in, end, id, value)) {
+                            return Status::NeedMore;
+                        }
+                        std::vector<std::string>& names = is_level ? levels : formats;
+                        if (id != names.size()) {
+                            return Status::Corrupt;
+                        }
+                        names.push_back(std::move(value));
+                        break;
+                    }
+                    case BinaryLogTag::Record: {
+                        std::uint64_t format, level, delta, size;
+                        if (!detail::getVarint(in, end, format) || !detail::getVarint(in, end, level)
+                                || !detail::getVarint(in, end, delta) || !detail::getVarint(in, end, size)
+                                || size > static_cast<std::uint64_t>(end - in)) {
+                            return Status::NeedMore;
+                        }
+                        args.clear();
+                        if (format >= formats.size() || level >= levels.size()
+                                || !detail::expandArgs(args, in, in + size)) {
+                            return Status::Corrupt;
+                        }
+                        last_time += detail::zigzagDecode(delta);
+                        record.level_name = levels[level].c_str();
+                        record.level = static_cast<std::uint32_t>(level);
+                        record.time = last_time;
+                        record.format = formats[format].c_str();
+                        record.args = args.data();
+                        record.size = args.size();
+                        pos += (in - begin) + size;
+                        return Status::Record;
+                    }
+                    default:
+                        return Status::Corrupt;
+                }
+                pos += in - begin;
+            }
+        }
+
+        // Return true if bytes of an unfinished entry are left over.
+        bool hasPartialEntry() const {
+            return pos < buffer.size();
+        }
+
+        // Get the number of bytes fed that hold whole entries.
+        std::uint64_t getDecodedSize() const {
+            return dropped + pos;
+        }
+    };
+
+    /***********************************************************
+     *  Append log records to a file in the binary log format,
+     *  which takes a fraction of the space of text and needs no
+     *  formatting. Read it with tools/acht_logcat. Appending to
+     *  an existing binary log file starts a new session in it.
+     *
+     *  A process that dies while writing can leave the last entry
+     *  of a file unfinished, and everything appended after it
+     *  would be read as part of that entry. So when it opens an
+     *  existing file, the sink decodes it and cuts off an
+     *  unfinished entry at the end, or fails to open if it
+     *  cannot. A file that is not in the binary log format is
+     *  appended to as it is.
+     ***********************************************************/
+    class BinaryFileSink : public LogSink {
+    private:
+        std::FILE* my_file;
+        BinaryLogEncoder encoder;
+        // The encoded records, reused.
+        std::string encoded;
+
+        /***********************************************************
+         *  Cut off an unfinished entry at the end of the file.
+         *  Return false if there is one and it could not be cut.
+         ***********************************************************/
+        static bool truncatePartialEntry(const std::string& path) {
+            std::FILE* file = std::fopen(path.c_str(), "rb");
+            if (file == nullptr) {
+                return true;
+            }
+            BinaryLogDecoder decoder;
+            BinaryLogDecoder::Record record;
+            BinaryLogDecoder::Status status = BinaryLogDecoder::Status::NeedMore;
+            char chunk[64 * 1024];
+            std::size_t size;
+            while (status == BinaryLogDecoder::Status::NeedMore
+                    && (size = std::fread(chunk, 1, sizeof(chunk), file)) > 0) {
+                decoder.feed(chunk, size);
+                while ((status = decoder.next(record)) == BinaryLogDecoder::Status::Record) {
+                }
+            }
+            std::fclose(file);
+            if (status != BinaryLogDecoder::Status::NeedMore || !decoder.hasPartialEntry()) {
+                return true;
+            }
+#if defined(__unix__) || defined(__APPLE__)
+            return ::truncate(path.c_str(), static_cast<off_t>(decoder.getDecodedSize())) == 0;
+#else
+            return false;
+#endif
+        }
+
+    protected:
+        void writeText(const char*, std::size_t) override {}
+
+    public:
+        explicit BinaryFileSink(const std::string& path, LogLevel level = LogLevel::DEBUG)
+        : LogSink(level), my_file(nullptr) {
+            if (truncatePartialEntry(path)) {
+                my_file = std::fopen(path.c_str(), "ab");
+            }
+            if (my_file) {
+                std::setvbuf(my_file, nullptr, _IONBF, 0);
+            }
+        }
+
+        ~BinaryFileSink() override {
+            if (my_file) {
+                std::fclose(my_file);
+            }
+        }
+
+        void write(const std::shared_ptr<const LogBatch>& batch) override {
+            LogLevel level = getLevel();
+            if (my_file == nullptr || batch->isEmpty() || batch->most_severe > level) {
+                return;
+            }
+            encoded.clear();
+            batch->forEachRecord([&](const LogBatch::Record& record) {
+                if (record.level <= level) {
+                    encoder.encode(encoded, record.level, record.time, record.format, record.args, record.size);
+                }
+            });
+            std::fwrite(encoded.data(), 1, encoded.size(), my_file);
+        }
+
+        bool needsText() const override {
+            return false;
+        }
+
+        // Return true if the file could be opened.
+        bool isOpen() const {
+            return my_file != nullptr;
+        }
+    };
+}
+
+#endif
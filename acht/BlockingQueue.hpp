@@ -0,0 +1,31 @@
+#ifndef _BLOCKING_QUEUE_HPP_
+#define _BLOCKING_QUEUE_HPP_
+
+#if defined(ACHT_LOCK_FREE_QUEUE)
+#include "RingQueue.hpp"
+#else
+#include "SyncQueue.hpp"
+#endif
+
+namespace acht {
+
+    /***********************************************************
+     *  The queue behind the task queues of ThreadPool and the
+     *  batches of AsyncLogSink: SyncQueue, or RingQueue if
+     *  ACHT_LOCK_FREE_QUEUE is defined. Both have the same
+     *  interface, so code using either builds with both.
+     *
+     *  With RingQueue, every lane preallocates the capacity the
+     *  queue was constructed with, and ThreadPool::setMaxTask()
+     *  cannot raise the limit above it (see RingQueue).
+     ***********************************************************/
+#if defined(ACHT_LOCK_FREE_QUEUE)
+    template <typename T>
+    using BlockingQueue = RingQueue<T>;
+#else
+    template <typename T>
+    using BlockingQueue = SyncQueue<T>;
+#endif
+}
+
+#endif
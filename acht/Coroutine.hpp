@@ -0,0 +1,451 @@
+#ifndef _COROUTINE_HPP_
+#define _COROUTINE_HPP_
+
+#if !defined(__cpp_impl_coroutine)
+#error "acht/Coroutine.hpp requires C++20 coroutines"
+#endif
+
+#include "ThreadPool.hpp"
+#include <coroutine>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <future>
+#include <optional>
+#include <vector>
+#include <utility>
+
+namespace acht {
+
+    template <typename T = void>
+    class Task;
+
+    namespace detail {
+
+        /***********************************************************
+         *  The part of a task's promise that does not depend on the
+         *  result type. A task starts suspended and, when it
+         *  finishes, transfers control straight to the coroutine
+         *  awaiting it.
+         ***********************************************************/
+        class TaskPromiseBase {
+        private:
+            struct FinalAwaiter {
+                bool await_ready() const noexcept {
+                    return false;
+                }
+
+                template <typename Promise>
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+                    std::coroutine_handle<> continuation = handle.promise().continuation;
+                    return continuation ? continuation : std::noop_coroutine();
+                }
+
+                void await_resume() const noexcept {}
+            };
+
+        public:
+            std::coroutine_handle<> continuation;
+            std::exception_ptr error;
+
+            std::suspend_always initial_suspend() const noexcept {
+                return {};
+            }
+
+            FinalAwaiter final_suspend() const noexcept {
+                return {};
+            }
+
+            void unhandled_exception() noexcept {
+                error = std::current_exception();
+            }
+        };
+
+        template <typename T>
+        class TaskPromise : public TaskPromiseBase {
+        private:
+            std::optional<T> value;
+
+        public:
+            Task<T> get_return_object() noexcept;
+
+            template <typename U>
+            void return_value(U&& result) {
+                value.emplace(std::forward<U>(result));
+            }
+
+            T result() {
+                if (error) {
+                    std::rethrow_exception(error);
+                }
+                return std::move(*value);
+            }
+        };
+
+        template <>
+        class TaskPromise<void> : public TaskPromiseBase {
+        public:
+            Task<void> get_return_object() noexcept;
+
+            void return_void() const noexcept {}
+
+            void result() {
+                if (error) {
+                    std::rethrow_exception(error);
+                }
+            }
+        };
+    }
+
+    /***********************************************************
+     *  A lazily started coroutine that produces a T.
+     *
+     *  The body starts running when the task is awaited, on the
+     *  awaiting thread, and the awaiting coroutine continues on
+     *  whichever thread the task finishes on. So a task that does
+     *  "co_await pool.schedule()" completes on the pool, and so
+     *  does its caller after the co_await.
+     ***********************************************************/
+    template <typename T>
+    class Task {
+    public:
+        using promise_type = detail::TaskPromise<T>;
+        using Handle = std::coroutine_handle<promise_type>;
+
+    private:
+        Handle my_handle;
+
+        /***********************************************************
+         *  Awaiting an empty (e.g. moved-from) task resumes the
+         *  awaiting coroutine at once and throws a no_state
+         *  future_error.
+         ***********************************************************/
+        struct Awaiter {
+            Handle handle;
+
+            bool await_ready() const noexcept {
+                return handle && handle.done();
+            }
+
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+                if (!handle) {
+                    return awaiting;
+                }
+                handle.promise().continuation = awaiting;
+                return handle;
+            }
+
+            T await_resume() {
+                if (!handle) {
+                    throw std::future_error(std::future_errc::no_state);
+                }
+                return handle.promise().result();
+            }
+        };
+
+    public:
+        explicit Task(Handle handle) noexcept : my_handle(handle) {}
+
+        Task(Task&& other) noexcept : my_handle(std::exchange(other.my_handle, nullptr)) {}
+
+        Task& operator=(Task&& other) noexcept {
+            if (this != &other) {
+                if (my_handle) {
+                    my_handle.destroy();
+                }
+                my_handle = std::exchange(other.my_handle, nullptr);
+            }
+            return *this;
+        }
+
+        // No copy
+        Task(const Task&) = delete;
+
+        // No assignment
+        Task& operator=(const Task&) = delete;
+
+        ~Task() {
+            if (my_handle) {
+                my_handle.destroy();
+            }
+        }
+
+        Awaiter operator co_await() const noexcept {
+            return Awaiter{my_handle};
+        }
+
+        // Return true if the task has run to completion.
+        bool isReady() const noexcept {
+            return !my_handle || my_handle.done();
+        }
+    };
+
+    namespace detail {
+
+        template <typename T>
+        Task<T> TaskPromise<T>::get_return_object() noexcept {
+            return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+        }
+
+        inline Task<void> TaskPromise<void>::get_return_object() noexcept {
+            return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+        }
+
+        /***********************************************************
+         *  A one-shot event a blocked thread waits for.
+         ***********************************************************/
+        class Event {
+        private:
+            std::mutex my_mutex;
+            std::condition_variable my_cond;
+            bool is_set = false;
+
+        public:
+            void set() {
+                std::lock_guard<std::mutex> lock(my_mutex);
+                is_set = true;
+                my_cond.notify_all();
+            }
+
+            void wait() {
+                std::unique_lock<std::mutex> lock(my_mutex);
+                my_cond.wait(lock, [this] { return is_set; });
+            }
+        };
+
+        /***********************************************************
+         *  The coroutine syncWait runs on the calling thread. It
+         *  sets the event once it is suspended at its end, so the
+         *  frame can be destroyed right after the wait.
+         ***********************************************************/
+        class SyncWaitTask {
+        public:
+            struct promise_type {
+                Event* event = nullptr;
+
+                SyncWaitTask get_return_object() noexcept {
+                    return SyncWaitTask(std::coroutine_handle<promise_type>::from_promise(*this));
+                }
+
+                std::suspend_always initial_suspend() const noexcept {
+                    return {};
+                }
+
+                auto final_suspend() const noexcept {
+                    struct SetEvent {
+                        bool await_ready() const noexcept {
+                            return false;
+                        }
+
+                        void await_suspend(std::coroutine_handle<promise_type> handle) const noexcept {
+                            handle.promise().event->set();
+                        }
+
+                        void await_resume() const noexcept {}
+                    };
+                    return SetEvent();
+                }
+
+                void return_void() const noexcept {}
+
+                void unhandled_exception() const noexcept {
+                    std::terminate();
+                }
+            };
+
+        private:
+            std::coroutine_handle<promise_type> my_handle;
+
+        public:
+            explicit SyncWaitTask(std::coroutine_handle<promise_type> handle) : my_handle(handle) {}
+
+            SyncWaitTask(SyncWaitTask&& other) noexcept : my_handle(std::exchange(other.my_handle, nullptr)) {}
+
+            ~SyncWaitTask() {
+                if (my_handle) {
+                    my_handle.destroy();
+                }
+            }
+
+            void run(Event& event) {
+                my_handle.promise().event = &event;
+                my_handle.resume();
+                event.wait();
+            }
+        };
+
+        template <typename T>
+        SyncWaitTask makeSyncWaitTask(const Task<T>& task, std::optional<T>& result, std::exception_ptr& error) {
+            try {
+                result.emplace(co_await task);
+            }
+            catch (...) {
+                error = std::current_exception();
+            }
+        }
+
+        inline SyncWaitTask makeSyncWaitTask(const Task<void>& task, std::exception_ptr& error) {
+            try {
+                co_await task;
+            }
+            catch (...) {
+                error = std::current_exception();
+            }
+        }
+
+        /***********************************************************
+         *  A coroutine that starts right away and nobody awaits.
+         ***********************************************************/
+        struct DetachedTask {
+            struct promise_type {
+                DetachedTask get_return_object() const noexcept {
+                    return {};
+                }
+
+                std::suspend_never initial_suspend() const noexcept {
+                    return {};
+                }
+
+                std::suspend_never final_suspend() const noexcept {
+                    return {};
+                }
+
+                void return_void() const noexcept {}
+
+                void unhandled_exception() const noexcept {
+                    std::terminate();
+                }
+            };
+        };
+
+        /***********************************************************
+         *  Counts the tasks of a whenAll still running, plus one for
+         *  the awaiting coroutine. Whoever brings the count to zero
+         *  resumes the awaiting coroutine.
+         ***********************************************************/
+        class WhenAllLatch {
+        private:
+            std::atomic<std::size_t> my_count;
+            std::coroutine_handle<> my_awaiting;
+            std::mutex error_mutex;
+            std::exception_ptr my_error;
+
+        public:
+            explicit WhenAllLatch(std::size_t tasks) : my_count(tasks + 1) {}
+
+            void fail(std::exception_ptr error) {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!my_error) {
+                    my_error = error;
+                }
+            }
+
+            void arrive() {
+                if (my_count.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    my_awaiting.resume();
+                }
+            }
+
+            void rethrowIfFailed() {
+                if (my_error) {
+                    std::rethrow_exception(my_error);
+                }
+            }
+
+            // Awaited after starting all tasks.
+            bool await_ready() const noexcept {
+                return false;
+            }
+
+            bool await_suspend(std::coroutine_handle<> awaiting) noexcept {
+                my_awaiting = awaiting;
+                // Don't suspend if every task finished already.
+                return my_count.fetch_sub(1, std::memory_order_acq_rel) != 1;
+            }
+
+            void await_resume() const noexcept {}
+        };
+
+        template <typename T>
+        DetachedTask runWhenAllTask(const Task<T>& task, std::optional<T>& result, WhenAllLatch& latch) {
+            try {
+                result.emplace(co_await task);
+            }
+            catch (...) {
+                latch.fail(std::current_exception());
+            }
+            latch.arrive();
+        }
+
+        inline DetachedTask runWhenAllTask(const Task<void>& task, WhenAllLatch& latch) {
+            try {
+                co_await task;
+            }
+            catch (...) {
+                latch.fail(std::current_exception());
+            }
+            latch.arrive();
+        }
+    }
+
+    /***********************************************************
+     *  Block the calling thread until the task finishes and
+     *  return its result (or rethrow its exception).
+     ***********************************************************/
+    template <typename T>
+    T syncWait(const Task<T>& task) {
+        detail::Event event;
+        std::optional<T> result;
+        std::exception_ptr error;
+        detail::makeSyncWaitTask(task, result, error).run(event);
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        return std::move(*result);
+    }
+
+    inline void syncWait(const Task<void>& task) {
+        detail::Event event;
+        std::exception_ptr error;
+        detail::makeSyncWaitTask(task, error).run(event);
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    /***********************************************************
+     *  Start all tasks and complete when every one of them has
+     *  finished, with their results in the same order. The tasks
+     *  start on the awaiting thread; the ones that begin with
+     *  "co_await pool.schedule()" then run concurrently on the
+     *  pool. The first exception thrown is rethrown.
+     ***********************************************************/
+    template <typename T>
+    Task<std::vector<T>> whenAll(std::vector<Task<T>> tasks) {
+        std::vector<std::optional<T>> results(tasks.size());
+        detail::WhenAllLatch latch(tasks.size());
+        for (std::size_t i = 0; i < tasks.size(); ++i) {
+            detail::runWhenAllTask(tasks[i], results[i], latch);
+        }
+        co_await latch;
+        latch.rethrowIfFailed();
+        std::vector<T> values;
+        values.reserve(results.size());
+        for (auto& result : results) {
+            values.push_back(std::move(*result));
+        }
+        co_return values;
+    }
+
+    inline Task<void> whenAll(std::vector<Task<void>> tasks) {
+        detail::WhenAllLatch latch(tasks.size());
+        for (auto& task : tasks) {
+            detail::runWhenAllTask(task, latch);
+        }
+        co_await latch;
+        latch.rethrowIfFailed();
+    }
+}
+
+#endif
@@ -0,0 +1,298 @@
+#ifndef _LOG_FORMAT_HPP_
+#define _LOG_FORMAT_HPP_
+
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <cstring>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+
+namespace acht {
+
+    /***********************************************************
+     *  The level of the events to be tracked (or the level of
+     *  messages to be sent).
+     ***********************************************************/
+    enum class LogLevel {
+        FATAL,
+        ERROR,
+        WARN,
+        INFO,
+        DEBUG
+    };
+
+    /***********************************************************
+     *  Get the name of a level as written in log files.
+     ***********************************************************/
+    inline const char* logLevelName(LogLevel level) {
+        switch (level) {
+            case LogLevel::FATAL:
+                return "FATAL";
+            case LogLevel::ERROR:
+                return "ERROR";
+            case LogLevel::WARN:
+                return "WARN";
+            case LogLevel::INFO:
+                return "INFO";
+            case LogLevel::DEBUG:
+                return "DEBUG";
+        }
+        return "";
+    }
+
+    /***********************************************************
+     *  The type tag written in front of every encoded argument
+     *  of a log record.
+     ***********************************************************/
+    enum class LogArgType : std::uint8_t {
+        Bool,
+        Char,
+        Int,
+        UInt,
+        Double,
+        String,
+        Pointer
+    };
+
+    namespace detail {
+
+        template <typename T>
+        struct AlwaysFalse : std::false_type {};
+
+        template <typename T>
+        void putRaw(char*& out, const T& value) {
+            std::memcpy(out, &value, sizeof(T));
+            out += sizeof(T);
+        }
+
+        template <typename T>
+        T getRaw(const char*& in) {
+            T value;
+            std::memcpy(&value, in, sizeof(T));
+            in += sizeof(T);
+            return value;
+        }
+
+        inline const char* argString(const char* value) {
+            return value ? value : "(null)";
+        }
+
+        /***********************************************************
+         *  Get the number of bytes an argument is encoded into.
+         ***********************************************************/
+        template <typename T>
+        std::size_t argSize(const T& value) {
+            using U = std::decay_t<T>;
+            if constexpr (std::is_same<U, bool>::value || std::is_same<U, char>::value) {
+                return 2;
+            }
+            else if constexpr (std::is_integral<U>::value || std::is_enum<U>::value
+                               || std::is_floating_point<U>::value) {
+                return 1 + 8;
+            }
+            else if constexpr (std::is_same<U, const char*>::value || std::is_same<U, char*>::value) {
+                return 1 + 4 + std::strlen(argString(value));
+            }
+            else if constexpr (std::is_convertible<const T&, std::string_view>::value) {
+                return 1 + 4 + std::string_view(value).size();
+            }
+            else if constexpr (std::is_pointer<U>::value) {
+                return 1 + 8;
+            }
+            else {
+                static_assert(AlwaysFalse<T>::value, "unsupported log argument type");
+                return 0;
+            }
+        }
+
+        /***********************************************************
+         *  Encode an argument as its type tag followed by its value.
+         *  Strings are copied with their length in front.
+         ***********************************************************/
+        template <typename T>
+        void encodeArg(char*& out, const T& value) {
+            using U = std::decay_t<T>;
+            if constexpr (std::is_same<U, bool>::value) {
+                *out++ = static_cast<char>(LogArgType::Bool);
+                *out++ = value ? 1 : 0;
+            }
+            else if constexpr (std::is_same<U, char>::value) {
+                *out++ = static_cast<char>(LogArgType::Char);
+                *out++ = value;
+            }
+            else if constexpr (std::is_enum<U>::value) {
+                *out++ = static_cast<char>(LogArgType::Int);
+                putRaw(out, static_cast<std::int64_t>(value));
+            }
+            else if constexpr (std::is_integral<U>::value && std::is_signed<U>::value) {
+                *out++ = static_cast<char>(LogArgType::Int);
+                putRaw(out, static_cast<std::int64_t>(value));
+            }
+            else if constexpr (std::is_integral<U>::value) {
+                *out++ = static_cast<char>(LogArgType::UInt);
+                putRaw(out, static_cast<std::uint64_t>(value));
+            }
+            else if constexpr (std::is_floating_point<U>::value) {
+                *out++ = static_cast<char>(LogArgType::Double);
+                putRaw(out, static_cast<double>(value));
+            }
+            else if constexpr (std::is_same<U, const char*>::value || std::is_same<U, char*>::value) {
+                encodeArg(out, std::string_view(argString(value)));
+            }
+            else if constexpr (std::is_convertible<const T&, std::string_view>::value) {
+                std::string_view text(value);
+                *out++ = static_cast<char>(LogArgType::String);
+                putRaw(out, static_cast<std::uint32_t>(text.size()));
+                std::memcpy(out, text.data(), text.size());
+                out += text.size();
+            }
+            else {
+                *out++ = static_cast<char>(LogArgType::Pointer);
+                putRaw(out, static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(value)));
+            }
+        }
+
+        inline std::size_t argsSize() {
+            return 0;
+        }
+
+        template <typename T, typename... Args>
+        std::size_t argsSize(const T& value, const Args&... args) {
+            return argSize(value) + argsSize(args...);
+        }
+
+        inline void encodeArgs(char*&) {}
+
+        template <typename T, typename... Args>
+        void encodeArgs(char*& out, const T& value, const Args&... args) {
+            encodeArg(out, value);
+            encodeArgs(out, args...);
+        }
+
+        /***********************************************************
+         *  Decode the argument at "in" and append it to "out".
+         *  Return false if the arguments end before it.
+         ***********************************************************/
+        template <typename String>
+        bool appendArg(String& out, const char*& in, const char* end) {
+            if (in >= end) {
+                return false;
+            }
+            char number[32];
+            switch (static_cast<LogArgType>(*in++)) {
+                case LogArgType::Bool:
+                    out += *in++ ? "true" : "false";
+                    return true;
+                case LogArgType::Char:
+                    out += *in++;
+                    return true;
+                case LogArgType::Int:
+                    std::snprintf(number, sizeof(number), "%lld", static_cast<long long>(getRaw<std::int64_t>(in)));
+                    break;
+                case LogArgType::UInt:
+                    std::snprintf(number, sizeof(number), "%llu", static_cast<unsigned long long>(getRaw<std::uint64_t>(in)));
+                    break;
+                case LogArgType::Double:
+                    std::snprintf(number, sizeof(number), "%g", getRaw<double>(in));
+                    break;
+                case LogArgType::String: {
+                    std::uint32_t size = getRaw<std::uint32_t>(in);
+                    out.append(in, size);
+                    in += size;
+                    return true;
+                }
+                case LogArgType::Pointer:
+                    std::snprintf(number, sizeof(number), "0x%llx", static_cast<unsigned long long>(getRaw<std::uint64_t>(in)));
+                    break;
+                default:
+                    in = end;
+                    return false;
+            }
+            out += number;
+            return true;
+        }
+    }
+
+    /***********************************************************
+     *  Append "format" to "out", replacing each "{}" with the
+     *  next encoded argument. "{{" and "}}" stand for literal
+     *  braces. Placeholders without an argument are kept as is.
+     *  "out" may be any std::basic_string of char.
+     ***********************************************************/
+    template <typename String>
+    void formatLogMessage(String& out, const char* format, const char* args, std::size_t size) {
+        const char* end = args + size;
+        for (const char* p = format; *p; ++p) {
+            if (p[0] == '{' && p[1] == '}') {
+                if (!detail::appendArg(out, args, end)) {
+                    out += "{}";
+                }
+                ++p;
+            }
+            else if ((p[0] == '{' && p[1] == '{') || (p[0] == '}' && p[1] == '}')) {
+                out += *p++;
+            }
+            else {
+                out += *p;
+            }
+        }
+    }
+
+    /***********************************************************
+     *  Formats times in nanoseconds since the epoch as local time
+     *  with microseconds. The date and time up to the second are
+     *  formatted only when the second changes.
+     ***********************************************************/
+    class LogTimeFormat {
+    private:
+        std::int64_t cached_second = -1;
+        char cached_time[24];
+
+    public:
+        void append(std::string& out, std::int64_t time) {
+            std::int64_t second = time / 1000000000;
+            std::int64_t nanos = time % 1000000000;
+            if (nanos < 0) {
+                --second;
+                nanos += 1000000000;
+            }
+            if (second != cached_second) {
+                std::time_t seconds = static_cast<std::time_t>(second);
+                std::tm local;
+#if defined(_WIN32)
+                localtime_s(&local, &seconds);
+#else
+                localtime_r(&seconds, &local);
+#endif
+                std::strftime(cached_time, sizeof(cached_time), "%Y-%m-%d %H:%M:%S", &local);
+                cached_second = second;
+            }
+            out += cached_time;
+            char micros[8] = {'.'};
+            int value = static_cast<int>(nanos / 1000);
+            for (int i = 6; i > 0; --i) {
+                micros[i] = static_cast<char>('0' + value % 10);
+                value /= 10;
+            }
+            out.append(micros, 7);
+        }
+    };
+
+    /***********************************************************
+     *  Append a log record to "out" as a line of text:
+     *  "time [LEVEL] message".
+     ***********************************************************/
+    inline void appendLogLine(std::string& out, LogTimeFormat& time_format, const char* level_name,
+                              std::int64_t time, const char* format, const char* args, std::size_t size) {
+        time_format.append(out, time);
+        out += " [";
+        out += level_name;
+        out += "] ";
+        formatLogMessage(out, format, args, size);
+        out += '\n';
+    }
+}
+
+#endif
@@ -0,0 +1,412 @@
+#ifndef _LOG_SINK_HPP_
+#define _LOG_SINK_HPP_
+
+#include "LogFormat.hpp"
+#include "MappedLogFile.hpp"
+#include "BlockingQueue.hpp"
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+
+namespace acht {
+
+    /***********************************************************
+     *  A batch of log records, as the write thread of a logger
+     *  hands it to every sink. The records are kept as they were
+     *  logged, with their encoded arguments; they are formatted
+     *  into "text" once, and only if a sink needs text. "lines"
+     *  says where each line starts and ends and its level, so
+     *  that sinks can pick the lines they want.
+     ***********************************************************/
+    struct LogBatch {
+        struct Line {
+            std::size_t offset;
+            std::size_t size;
+            LogLevel level;
+        };
+
+        struct Record {
+            LogLevel level;
+            std::int64_t time;
+            const char* format;
+            const char* args;
+            std::size_t size;
+        };
+
+        // How a record is stored in "records", followed by its arguments.
+        struct RecordHeader {
+            std::int64_t time;
+            const char* format;
+            std::size_t size;
+            LogLevel level;
+        };
+
+        std::string text;
+        std::vector<Line> lines;
+        // The records, each a RecordHeader followed by its arguments.
+        std::string records;
+        std::size_t count = 0;
+        // The most and least severe level of the records.
+        LogLevel most_severe = LogLevel::DEBUG;
+        LogLevel least_severe = LogLevel::FATAL;
+
+        /***********************************************************
+         *  Add a record. The format must be a string literal, as
+         *  only the pointer is kept.
+         ***********************************************************/
+        void addRecord(LogLevel level, std::int64_t time, const char* format, const char* args, std::size_t size) {
+            RecordHeader header{time, format, size, level};
+            records.append(reinterpret_cast<const char*>(&header), sizeof(header));
+            records.append(args, size);
+            ++count;
+            most_severe = std::min(most_severe, level);
+            least_severe = std::max(least_severe, level);
+        }
+
+        // Call f(const Record&) for each record, in order.
+        template <typename F>
+        void forEachRecord(F&& f) const {
+            const char* in = records.data();
+            const char* end = in + records.size();
+            while (in < end) {
+                RecordHeader header;
+                std::memcpy(&header, in, sizeof(header));
+                in += sizeof(header);
+                f(Record{header.level, header.time, header.format, in, header.size});
+                in += header.size;
+            }
+        }
+
+        // Record that the text from "offset" on is a line of the given level.
+        void addLine(std::size_t offset, LogLevel level) {
+            lines.push_back(Line{offset, text.size() - offset, level});
+        }
+
+        // Return true if the records have been formatted.
+        bool isFormatted() const {
+            return lines.size() == count;
+        }
+
+        void clear() {
+            text.clear();
+            lines.clear();
+            records.clear();
+            count = 0;
+            most_severe = LogLevel::DEBUG;
+            least_severe = LogLevel::FATAL;
+        }
+
+        bool isEmpty() const {
+            return count == 0;
+        }
+    };
+
+    /***********************************************************
+     *  A destination of log records. A sink has its own level:
+     *  it gets only the lines at least as severe as that level
+     *  (on top of the level of the logger). Sinks are called by
+     *  the write thread of the logger only, so a sink that is
+     *  slow holds up the others; wrap it in an AsyncLogSink.
+     ***********************************************************/
+    class LogSink {
+    private:
+        std::atomic<LogLevel> my_level;
+        // The lines that passed the level filter, reused.
+        std::string filtered;
+
+    protected:
+        /***********************************************************
+         *  Write whole lines of text.
+         ***********************************************************/
+        virtual void writeText(const char* data, std::size_t size) = 0;
+
+    public:
+        explicit LogSink(LogLevel level = LogLevel::DEBUG) : my_level(level) {}
+
+        virtual ~LogSink() = default;
+
+        // No copy
+        LogSink(const LogSink&) = delete;
+
+        // No assignment
+        LogSink& operator=(const LogSink&) = delete;
+
+        /***********************************************************
+         *  Write the lines of a batch that pass the level of this
+         *  sink. Lines are copied only if some of them are left out.
+         ***********************************************************/
+        virtual void write(const std::shared_ptr<const LogBatch>& batch) {
+            LogLevel level = my_level.load(std::memory_order_relaxed);
+            if (batch->lines.empty() || batch->most_severe > level) {
+                return;
+            }
+            if (batch->least_severe <= level) {
+                writeText(batch->text.data(), batch->text.size());
+                return;
+            }
+            filtered.clear();
+            for (const LogBatch::Line& line : batch->lines) {
+                if (line.level <= level) {
+                    filtered.append(batch->text, line.offset, line.size);
+                }
+            }
+            writeText(filtered.data(), filtered.size());
+        }
+
+        /***********************************************************
+         *  Wait until everything written so far has reached its
+         *  destination.
+         ***********************************************************/
+        virtual void flush() {}
+
+        /***********************************************************
+         *  Return true if the sink writes the text of a batch. A
+         *  batch is only formatted if some sink needs the text.
+         ***********************************************************/
+        virtual bool needsText() const {
+            return true;
+        }
+
+        // Set the least severe level this sink writes.
+        void setLevel(LogLevel level) {
+            my_level = level;
+        }
+
+        // Get the least severe level this sink writes.
+        LogLevel getLevel() const {
+            return my_level;
+        }
+    };
+
+    /***********************************************************
+     *  Append log records to a file. The file is unbuffered: the
+     *  logger does its own buffering, so every batch goes to the
+     *  file in a single write.
+     ***********************************************************/
+    class FileSink : public LogSink {
+    private:
+        std::FILE* my_file;
+
+    protected:
+        void writeText(const char* data, std::size_t size) override {
+            if (my_file) {
+                std::fwrite(data, 1, size, my_file);
+            }
+        }
+
+    public:
+        explicit FileSink(const std::string& path, LogLevel level = LogLevel::DEBUG)
+        : LogSink(level), my_file(std::fopen(path.c_str(), "a")) {
+            if (my_file) {
+                std::setvbuf(my_file, nullptr, _IONBF, 0);
+            }
+        }
+
+        ~FileSink() override {
+            if (my_file) {
+                std::fclose(my_file);
+            }
+        }
+
+        // Return true if the file could be opened.
+        bool isOpen() const {
+            return my_file != nullptr;
+        }
+    };
+
+    /***********************************************************
+     *  Write log records to a memory-mapped file with rotation
+     *  (see MappedLogFile).
+     ***********************************************************/
+    class MappedFileSink : public LogSink {
+    private:
+        MappedLogFile my_file;
+
+    protected:
+        void writeText(const char* data, std::size_t size) override {
+            my_file.write(data, size);
+        }
+
+    public:
+        explicit MappedFileSink(const std::string& path, const RotationPolicy& policy = RotationPolicy(),
+                                LogLevel level = LogLevel::DEBUG)
+        : LogSink(level), my_file(path, policy) {}
+
+        // Return true if the file could be opened and mapped.
+        bool isOpen() const {
+            return my_file.isOpen();
+        }
+    };
+
+    /***********************************************************
+     *  Write log records to the standard error stream, by
+     *  default only ERROR and FATAL ones.
+     ***********************************************************/
+    class StderrSink : public LogSink {
+    protected:
+        void writeText(const char* data, std::size_t size) override {
+            std::fwrite(data, 1, size, stderr);
+            std::fflush(stderr);
+        }
+
+    public:
+        explicit StderrSink(LogLevel level = LogLevel::ERROR) : LogSink(level) {}
+    };
+
+    /***********************************************************
+     *  Keep the last "capacity" bytes of log records in memory,
+     *  for example to dump them when the program crashes.
+     ***********************************************************/
+    class MemoryRingSink : public LogSink {
+    private:
+        std::vector<char> my_ring;
+        // The total number of bytes ever written.
+        std::uint64_t my_written;
+        mutable std::mutex my_mutex;
+
+    protected:
+        void writeText(const char* data, std::size_t size) override {
+            std::lock_guard<std::mutex> lock(my_mutex);
+            if (size > my_ring.size()) {
+                data += size - my_ring.size();
+                my_written += size - my_ring.size();
+                size = my_ring.size();
+            }
+            std::size_t start = static_cast<std::size_t>(my_written % my_ring.size());
+            std::size_t first = std::min(size, my_ring.size() - start);
+            std::memcpy(my_ring.data() + start, data, first);
+            std::memcpy(my_ring.data(), data + first, size - first);
+            my_written += size;
+        }
+
+    public:
+        explicit MemoryRingSink(std::size_t capacity = 1024 * 1024, LogLevel level = LogLevel::DEBUG)
+        : LogSink(level), my_ring(std::max<std::size_t>(capacity, 1)), my_written(0) {}
+
+        /***********************************************************
+         *  Get the lines kept, oldest first. A line that was partly
+         *  overwritten is left out.
+         ***********************************************************/
+        std::string getContents() const {
+            std::lock_guard<std::mutex> lock(my_mutex);
+            if (my_written <= my_ring.size()) {
+                return std::string(my_ring.data(), static_cast<std::size_t>(my_written));
+            }
+            std::size_t start = static_cast<std::size_t>(my_written % my_ring.size());
+            std::string contents(my_ring.data() + start, my_ring.size() - start);
+            contents.append(my_ring.data(), start);
+            std::size_t newline = contents.find('\n');
+            return newline == std::string::npos ? std::string() : contents.substr(newline + 1);
+        }
+
+        /***********************************************************
+         *  Write the lines kept to a file, e.g. stderr.
+         ***********************************************************/
+        void dump(std::FILE* file) const {
+            std::string contents = getContents();
+            std::fwrite(contents.data(), 1, contents.size(), file);
+            std::fflush(file);
+        }
+    };
+
+    /***********************************************************
+     *  Run a slow sink on its own thread, behind its own queue
+     *  of batches, so that it cannot hold up the logger and the
+     *  other sinks. Batches are shared, not copied. If the queue
+     *  is full, the batch is dropped for this sink and counted.
+     *  The level filter of the wrapped sink applies.
+     ***********************************************************/
+    class AsyncLogSink : public LogSink {
+    private:
+        std::shared_ptr<LogSink> my_sink;
+        BlockingQueue<std::shared_ptr<const LogBatch>> my_queue;
+        std::thread my_thread;
+        // Batches put but not written yet.
+        int pending;
+        std::atomic<std::uint64_t> dropped_batches;
+        std::mutex my_mutex;
+        std::condition_variable idle;
+
+        void run() {
+            std::shared_ptr<const LogBatch> batch;
+            while (my_queue.take(batch)) {
+                my_sink->write(batch);
+                batch = nullptr;
+                std::lock_guard<std::mutex> lock(my_mutex);
+                if (--pending == 0) {
+                    idle.notify_all();
+                }
+            }
+        }
+
+    protected:
+        void writeText(const char*, std::size_t) override {}
+
+    public:
+        explicit AsyncLogSink(std::shared_ptr<LogSink> sink, int queue_size = 64)
+        : my_sink(std::move(sink)), my_queue(queue_size), pending(0), dropped_batches(0) {
+            my_thread = std::thread([this] {
+                run();
+            });
+        }
+
+        /***********************************************************
+         *  Destructor. Write what is queued, then stop.
+         ***********************************************************/
+        ~AsyncLogSink() override {
+            flush();
+            my_queue.stop();
+            my_thread.join();
+        }
+
+        void write(const std::shared_ptr<const LogBatch>& batch) override {
+            if (batch->isEmpty() || batch->most_severe > my_sink->getLevel()) {
+                return;
+            }
+            {
+                std::lock_guard<std::mutex> lock(my_mutex);
+                ++pending;
+            }
+            if (!my_queue.tryPutFor(batch, std::chrono::seconds(0))) {
+                dropped_batches.fetch_add(1, std::memory_order_relaxed);
+                std::lock_guard<std::mutex> lock(my_mutex);
+                if (--pending == 0) {
+                    idle.notify_all();
+                }
+            }
+        }
+
+        void flush() override {
+            {
+                std::unique_lock<std::mutex> lock(my_mutex);
+                idle.wait(lock, [this] {
+                    return pending == 0;
+                });
+            }
+            my_sink->flush();
+        }
+
+        bool needsText() const override {
+            return my_sink->needsText();
+        }
+
+        // Get the sink that does the writing.
+        const std::shared_ptr<LogSink>& getSink() const {
+            return my_sink;
+        }
+
+        // Get the number of batches dropped because the queue was full.
+        std::uint64_t getDroppedBatches() const {
+            return dropped_batches.load(std::memory_order_relaxed);
+        }
+    };
+}
+
+#endif
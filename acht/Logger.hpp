@@ -1,35 +1,154 @@
 #ifndef _LOGGER_HPP_
 #define _LOGGER_HPP_
 
-#include "SyncQueue.hpp"
+#include "LogFormat.hpp"
+#include "LogSink.hpp"
+#include "BinaryLog.hpp"
+#include "MemoryPool.hpp"
 #include <string>
-#include <fstream>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
 #include <memory>
 #include <iostream>
 #include <thread>
 #include <chrono>
 #include <ctime>
-#include <iomanip>
-#include <sstream>
 #include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+/***********************************************************
+ *  The least severe level that is compiled in. The LOG_X
+ *  macros of less severe levels expand to nothing, so their
+ *  arguments are not even evaluated. For example, build with
+ *  -DACHT_LOG_MIN_LEVEL=ACHT_LOG_LEVEL_INFO to remove
+ *  LOG_DEBUG statements.
+ ***********************************************************/
+#define ACHT_LOG_LEVEL_FATAL 0
+#define ACHT_LOG_LEVEL_ERROR 1
+#define ACHT_LOG_LEVEL_WARN 2
+#define ACHT_LOG_LEVEL_INFO 3
+#define ACHT_LOG_LEVEL_DEBUG 4
+
+#ifndef ACHT_LOG_MIN_LEVEL
+#define ACHT_LOG_MIN_LEVEL ACHT_LOG_LEVEL_DEBUG
+#endif
 
 namespace acht {
 
     class Logger {
     public:
-        using LogRecord = std::string;
         using LogMessage = std::string;
 
+        // The level of the events to be tracked (see LogLevel).
+        using Level = LogLevel;
+
         /***********************************************************
-         *  The level of the events to be tracked (or the level of
-         *  messages to be sent).
+         *  A log record as captured by the logging thread: the
+         *  level, the time in nanoseconds since the epoch, the
+         *  format string and the encoded arguments (see
+         *  LogFormat.hpp). It is formatted by the write thread.
+         *  Records are filled in place in the slots of the thread
+         *  buffers, and arguments that fit are stored inline, so
+         *  capturing a record does not allocate. Larger arguments
+         *  go to a block from the MemoryPool, which the slot keeps
+         *  for the next records.
          ***********************************************************/
-        enum class Level {
-            FATAL,
-            ERROR,
-            WARN,
-            INFO,
-            DEBUG
+        struct LogRecord {
+            static constexpr std::size_t inline_size = 96;
+
+            Level level;
+            std::int64_t time;
+            const char* format;
+            std::size_t size;
+            char inline_args[inline_size];
+            char* heap_args = nullptr;
+            std::size_t heap_size = 0;
+
+            LogRecord() = default;
+
+            // No copy
+            LogRecord(const LogRecord&) = delete;
+
+            // No assignment
+            LogRecord& operator=(const LogRecord&) = delete;
+
+            ~LogRecord() {
+                MemoryPool::deallocate(heap_args, heap_size);
+            }
+
+            // Get room for "bytes" bytes of encoded arguments.
+            char* allocate(std::size_t bytes) {
+                size = bytes;
+                if (bytes <= inline_size) {
+                    return inline_args;
+                }
+                if (bytes > heap_size) {
+                    MemoryPool::deallocate(heap_args, heap_size);
+                    heap_args = nullptr;
+                    heap_size = 0;
+                    std::size_t block = MemoryPool::blockSize(bytes);
+                    heap_args = static_cast<char*>(MemoryPool::allocate(block));
+                    heap_size = block;
+                }
+                return heap_args;
+            }
+
+            // Get the encoded arguments.
+            const char* getArgs() const {
+                return size <= inline_size ? inline_args : heap_args;
+            }
+        };
+
+        /***********************************************************
+         *  When the write thread hands its buffered records to the
+         *  log file. Records are written once "buffer_size" bytes
+         *  are buffered, once the oldest buffered record is
+         *  "interval" old, or right away after a record at least as
+         *  severe as "flush_level".
+         ***********************************************************/
+        struct FlushPolicy {
+            std::size_t buffer_size;
+            std::chrono::milliseconds interval;
+            Level flush_level;
+
+            FlushPolicy(std::size_t buffer_size = 64 * 1024,
+                        std::chrono::milliseconds interval = std::chrono::milliseconds(100),
+                        Level flush_level = Level::ERROR)
+            : buffer_size(buffer_size), interval(interval), flush_level(flush_level) {}
+        };
+
+        /***********************************************************
+         *  What a thread does when its buffer is full:
+         *  Block: wait until the write thread makes room.
+         *  DropNewest: drop the new record.
+         *  DropOldest: drop the oldest record in the buffer (or the
+         *  new one if the write thread is just taking the oldest).
+         *  Sample: let each call site (each format string) log at
+         *  most the sample rate of records per second, and drop the
+         *  new record if the buffer is full all the same. Messages
+         *  that are not string literals share one call site.
+         ***********************************************************/
+        enum class OverflowPolicy {
+            Block,
+            DropNewest,
+            DropOldest,
+            Sample
+        };
+
+        /***********************************************************
+         *  The number of records each overflow policy dropped.
+         ***********************************************************/
+        struct DropCounts {
+            std::uint64_t newest = 0;
+            std::uint64_t oldest = 0;
+            std::uint64_t sampled = 0;
+
+            std::uint64_t getTotal() const {
+                return newest + oldest + sampled;
+            }
         };
 
         /***********************************************************
@@ -38,8 +157,9 @@ namespace acht {
          *  different form logger's level, reset it.
          ***********************************************************/
         static std::shared_ptr<Logger> getLogger(Level level = Level::DEBUG) {
+            std::lock_guard<std::mutex> lock(instance_mutex);
             if (my_logger == nullptr) {
-                my_logger = std::shared_ptr<Logger>(new Logger(level));
+                createLogger(level);
             }
             else if (my_logger->my_level != level) {
                 my_logger->setLevel(level);
@@ -47,10 +167,40 @@ namespace acht {
             return my_logger;
         }
 
+        /***********************************************************
+         *  Get the instance of logger, creating it if there is none
+         *  yet, without touching its level. This is what the LOG_X
+         *  macros use: once the logger exists it is a single atomic
+         *  load. The logger must not be destroyed while it is used.
+         ***********************************************************/
+        static Logger& getInstance() {
+            Logger* logger = my_instance.load(std::memory_order_acquire);
+            if (logger == nullptr) {
+                std::lock_guard<std::mutex> lock(instance_mutex);
+                if (my_logger == nullptr) {
+                    createLogger(Level::DEBUG);
+                }
+                logger = my_logger.get();
+            }
+            return *logger;
+        }
+
+        /***********************************************************
+         *  Return true if messages of the given level are written.
+         ***********************************************************/
+        static bool isEnabled(Level level) {
+            return level <= getInstance().my_level.load(std::memory_order_relaxed);
+        }
+
+        // What a LOG_X macro compiled out by ACHT_LOG_MIN_LEVEL becomes.
+        static void discard() {}
+
         /***********************************************************
          *  Destroy the logger.
          ***********************************************************/
         static void destroyLogger() {
+            std::lock_guard<std::mutex> lock(instance_mutex);
+            my_instance = nullptr;
             my_logger = nullptr;
         }
 
@@ -58,30 +208,142 @@ namespace acht {
          *  Destructor.
          ***********************************************************/
         ~Logger() {
-            // Stop the logger and close the file stream.
+            // Stop the logger and close the log file.
             stop();
-            if (log_file_stream) {
-                log_file_stream->close();
-                log_file_stream = nullptr;
+            std::lock_guard<std::mutex> lock(my_mutex);
+            file_sink = nullptr;
+            my_sinks.clear();
+        }
+
+        /***********************************************************
+         *  Add log record to the buffer of the calling thread.
+         ***********************************************************/
+        void write(Level level, std::string_view log_msg) {
+            log(level, log_msg);
+        }
+
+        /***********************************************************
+         *  A format string that is known to live as long as the
+         *  logger, normally a string literal. The LOG_X macros make
+         *  one only when they see a literal; anything else is
+         *  formatted and copied on the calling thread.
+         ***********************************************************/
+        class LiteralFormat {
+        private:
+            const char* my_format;
+
+        public:
+            explicit LiteralFormat(const char* format) : my_format(format) {}
+
+            const char* get() const {
+                return my_format;
+            }
+        };
+
+        /***********************************************************
+         *  Add a log record with a format string to the buffer of
+         *  the calling thread.
+         *  Each "{}" in the format is replaced with the next
+         *  argument; "{{" and "}}" stand for literal braces.
+         *  Arguments may be integers, floating point numbers,
+         *  bools, chars, strings and pointers.
+         *
+         *  Only the time, a pointer to the format and a copy of the
+         *  arguments are taken here; the text is formatted by the
+         *  write thread. That is why the format has to be wrapped
+         *  in a LiteralFormat.
+         *
+         *  Each logging thread has its own buffer, so this takes no
+         *  lock unless the buffer is full and the overflow policy is
+         *  to wait for the write thread. Records written after the
+         *  logger was stopped are dropped.
+         ***********************************************************/
+        template <typename... Args>
+        void log(Level level, LiteralFormat format, const Args&... args) {
+            if (level > my_level || need_to_stop.load(std::memory_order_relaxed)) {
+                return;
+            }
+
+            std::int64_t time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+            OverflowPolicy policy = overflow_policy.load(std::memory_order_relaxed);
+            if (policy == OverflowPolicy::Sample && !takeSample(format.get(), time)) {
+                dropped_sampled.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+
+            ThreadBuffer& buffer = getThreadBuffer();
+            LogRecord* record = buffer.claim();
+            if (record == nullptr) {
+                record = overflow(buffer, policy);
+                if (record == nullptr) {
+                    return;
+                }
+            }
+            record->level = level;
+            record->time = time;
+            record->format = format.get();
+            char* out = record->allocate(detail::argsSize(args...));
+            detail::encodeArgs(out, args...);
+            buffer.publish();
+
+            // The write thread wakes up on its own once the flush
+            // interval is over; only urgent records and a buffer
+            // filling up are worth waking it early.
+            if (writer_sleeping.load() && (level <= flush_level.load(std::memory_order_relaxed) || buffer.isHalfFull())) {
+                wakeWriteThread();
             }
         }
 
         /***********************************************************
-         *  Add log record to the log queue.
+         *  Add a log record with a format string that may not
+         *  outlive this call, such as a buffer on the stack. The
+         *  message is formatted here, in memory from the
+         *  MemoryPool, and copied.
          ***********************************************************/
-        void write(Level level, const LogMessage& log_msg) {
+        template <typename Arg, typename... Args>
+        void log(Level level, const char* format, const Arg& arg, const Args&... args) {
             if (level > my_level) {
                 return;
             }
+            PoolString encoded(detail::argsSize(arg, args...), '\0');
+            char* out = &encoded[0];
+            detail::encodeArgs(out, arg, args...);
+            PoolString log_msg;
+            formatLogMessage(log_msg, format, encoded.data(), encoded.size());
+            log(level, std::string_view(log_msg));
+        }
 
-            // Create log record
-            std::stringstream log_record_stream;
-            log_record_stream << getCurrentTime()
-                << " [" << levelToString(level) << "] "
-                << log_msg;
+        template <typename Arg, typename... Args>
+        void log(Level level, const LogMessage& format, const Arg& arg, const Args&... args) {
+            log(level, format.c_str(), arg, args...);
+        }
 
-            // Add the log record to log queue
-            log_queue.put(log_record_stream.str());
+        /***********************************************************
+         *  Add a log record with a ready-made message, which is
+         *  copied as it is; braces in it are not replaced.
+         ***********************************************************/
+        void log(Level level, std::string_view log_msg) {
+            log(level, LiteralFormat("{}"), log_msg);
+        }
+
+        /***********************************************************
+         *  What the LOG_X macros call. Only a string literal that
+         *  comes with arguments is kept as a format pointer; a lone
+         *  message is copied into the record as an argument, and a
+         *  format in a buffer is formatted right away.
+         ***********************************************************/
+        template <bool IsLiteral, typename Format, typename... Args>
+        void logChecked(Level level, const Format& format, const Args&... args) {
+            if constexpr (sizeof...(Args) == 0) {
+                log(level, LiteralFormat("{}"), format);
+            }
+            else if constexpr (IsLiteral) {
+                log(level, LiteralFormat(format), args...);
+            }
+            else {
+                log(level, format, args...);
+            }
         }
 
         /***********************************************************
@@ -107,18 +369,109 @@ namespace acht {
         }
 
         /***********************************************************
-         *  Stop the logger.
+         *  Set when buffered log records are written to the file.
+         ***********************************************************/
+        void setFlushPolicy(const FlushPolicy& policy) {
+            std::lock_guard<std::mutex> lock(my_mutex);
+            flush_policy = policy;
+            flush_level = policy.flush_level;
+        }
+
+        /***********************************************************
+         *  Get when buffered log records are written to the file.
+         ***********************************************************/
+        FlushPolicy getFlushPolicy() const {
+            std::lock_guard<std::mutex> lock(my_mutex);
+            return flush_policy;
+        }
+
+        /***********************************************************
+         *  Set what a thread does when its buffer is full.
+         ***********************************************************/
+        void setOverflowPolicy(OverflowPolicy policy) {
+            overflow_policy = policy;
+        }
+
+        /***********************************************************
+         *  Get what a thread does when its buffer is full.
+         ***********************************************************/
+        OverflowPolicy getOverflowPolicy() const {
+            return overflow_policy;
+        }
+
+        /***********************************************************
+         *  Set how many records per second each call site may log
+         *  with OverflowPolicy::Sample.
+         ***********************************************************/
+        void setSampleRate(int records_per_second) {
+            sample_rate = std::max(records_per_second, 1);
+        }
+
+        /***********************************************************
+         *  Get how many records per second each call site may log
+         *  with OverflowPolicy::Sample.
+         ***********************************************************/
+        int getSampleRate() const {
+            return sample_rate;
+        }
+
+        /***********************************************************
+         *  Set the number of records the buffer of each thread
+         *  holds, rounded up to a power of two. Threads switch to a
+         *  buffer of the new size the next time they log.
+         ***********************************************************/
+        void setBufferCapacity(std::size_t capacity) {
+            std::size_t rounded = 2;
+            while (rounded < capacity) {
+                rounded <<= 1;
+            }
+            buffer_capacity = rounded;
+        }
+
+        /***********************************************************
+         *  Get the number of records the buffer of each thread holds.
+         ***********************************************************/
+        std::size_t getBufferCapacity() const {
+            return buffer_capacity;
+        }
+
+        /***********************************************************
+         *  Get the number of records dropped so far. The write
+         *  thread also reports new drops in the log file, at most
+         *  once a second.
+         ***********************************************************/
+        DropCounts getDropCounts() const {
+            DropCounts counts;
+            counts.newest = dropped_newest.load(std::memory_order_relaxed);
+            counts.oldest = dropped_oldest.load(std::memory_order_relaxed);
+            counts.sampled = dropped_sampled.load(std::memory_order_relaxed);
+            return counts;
+        }
+
+        /***********************************************************
+         *  Stop the logger. The log records written before are in
+         *  the log file when it returns.
          ***********************************************************/
         void stop() {
             if (!need_to_stop) {
                 need_to_stop = true;
 
-                // Stop the log queue
-                log_queue.stop();
+                // Wake up the write thread and the threads waiting for it
+                {
+                    std::lock_guard<std::mutex> lock(wake_mutex);
+                    writer_cond.notify_all();
+                    space_cond.notify_all();
+                }
 
                 // Wait until all log records are written to file
                 write_thread->join();
                 write_thread = nullptr;
+
+                // Wait until the sinks have written them, too
+                std::lock_guard<std::mutex> lock(my_mutex);
+                for (auto& sink : my_sinks) {
+                    sink->flush();
+                }
             }
         }
 
@@ -131,7 +484,6 @@ namespace acht {
                 write_thread = std::make_shared<std::thread>([this] {
                     runWriteThread();
                 });
-                log_queue.start();
             }
         }
 
@@ -140,15 +492,61 @@ namespace acht {
          ***********************************************************/
         bool setLogFilePath(const std::string& log_file_path) {
             std::lock_guard<std::mutex> lock(my_mutex);
-            if (my_log_file_path == log_file_path) {
+            if (my_log_file_path == log_file_path && dynamic_cast<FileSink*>(file_sink.get()) != nullptr) {
                 return true;
             }
             else {
+                file_sink = nullptr;
                 my_log_file_path = log_file_path;
                 return setFileStream(log_file_path);
             }
         }
 
+        /***********************************************************
+         *  Send the log records to a memory-mapped log file at the
+         *  given path instead, rotated as the policy says (see
+         *  MappedLogFile). Return false and go on writing to the
+         *  current path if it cannot be mapped.
+         ***********************************************************/
+        bool setMappedLogFile(const std::string& log_file_path, const RotationPolicy& policy = RotationPolicy()) {
+            std::lock_guard<std::mutex> lock(my_mutex);
+            // Finish the old file first, it may be the same file
+            if (isMapped()) {
+                file_sink = nullptr;
+            }
+            auto sink = std::make_shared<MappedFileSink>(log_file_path, policy);
+            if (!sink->isOpen()) {
+                std::cerr << "Failed to map log file: " << log_file_path << std::endl;
+                // Go on with a plain file if the old one was mapped
+                if (!file_sink) {
+                    setFileStream(my_log_file_path);
+                }
+                return false;
+            }
+            file_sink = std::move(sink);
+            my_log_file_path = log_file_path;
+            return true;
+        }
+
+        /***********************************************************
+         *  Send the log records to a file in the binary log format
+         *  instead (see BinaryLog.hpp), which is several times
+         *  smaller and spares the write thread the formatting. Use
+         *  tools/acht_logcat to read it.
+         ***********************************************************/
+        bool setBinaryLogFile(const std::string& log_file_path) {
+            std::lock_guard<std::mutex> lock(my_mutex);
+            file_sink = nullptr;
+            my_log_file_path = log_file_path;
+            auto sink = std::make_shared<BinaryFileSink>(log_file_path);
+            if (!sink->isOpen()) {
+                std::cerr << "Failed to open log file: " << log_file_path << std::endl;
+                return false;
+            }
+            file_sink = std::move(sink);
+            return true;
+        }
+
         /***********************************************************
          *  Get the log file path where the log records are send to.
          ***********************************************************/
@@ -157,15 +555,258 @@ namespace acht {
             return my_log_file_path;
         }
 
+        /***********************************************************
+         *  Send the log records to another sink as well as the log
+         *  file, e.g. a StderrSink for errors or a MemoryRingSink.
+         *  Each record is formatted once for the file and all sinks.
+         *  Sinks are called from the write thread one after the
+         *  other; wrap a slow one in an AsyncLogSink.
+         ***********************************************************/
+        void addSink(std::shared_ptr<LogSink> sink) {
+            std::lock_guard<std::mutex> lock(my_mutex);
+            my_sinks.push_back(std::move(sink));
+        }
+
+        /***********************************************************
+         *  Stop sending the log records to a sink.
+         ***********************************************************/
+        void removeSink(const std::shared_ptr<LogSink>& sink) {
+            std::lock_guard<std::mutex> lock(my_mutex);
+            my_sinks.erase(std::remove(my_sinks.begin(), my_sinks.end(), sink), my_sinks.end());
+        }
+
     private:
-        SyncQueue<LogRecord> log_queue;
+        // Text formatted on the calling thread
+        using PoolString = std::basic_string<char, std::char_traits<char>, PoolAllocator<char>>;
+
+        /***********************************************************
+         *  Written batches kept with their buffers for reuse. The
+         *  last one to let go of a batch, the write thread or an
+         *  asynchronous sink, puts it back here, so the write thread
+         *  never reuses a batch a sink may still read. Sinks keep
+         *  the recycler alive if they outlive the logger.
+         ***********************************************************/
+        class BatchRecycler : public std::enable_shared_from_this<BatchRecycler> {
+        private:
+            static constexpr std::size_t max_batches = 64;
+            std::mutex my_mutex;
+            std::vector<std::unique_ptr<LogBatch>> my_batches;
+
+            void put(LogBatch* batch) {
+                std::unique_ptr<LogBatch> released(batch);
+                std::lock_guard<std::mutex> lock(my_mutex);
+                if (my_batches.size() < max_batches) {
+                    my_batches.push_back(std::move(released));
+                }
+            }
+
+        public:
+            // Get an empty batch, reused if there is one.
+            std::shared_ptr<LogBatch> get() {
+                std::unique_ptr<LogBatch> batch;
+                {
+                    std::lock_guard<std::mutex> lock(my_mutex);
+                    if (!my_batches.empty()) {
+                        batch = std::move(my_batches.back());
+                        my_batches.pop_back();
+                    }
+                }
+                if (batch) {
+                    batch->clear();
+                }
+                else {
+                    batch.reset(new LogBatch());
+                }
+                std::shared_ptr<BatchRecycler> self = shared_from_this();
+                return std::shared_ptr<LogBatch>(batch.release(), [self](LogBatch* released) {
+                    self->put(released);
+                }, PoolAllocator<char>());
+            }
+        };
+
+        /***********************************************************
+         *  A bounded single-producer/single-consumer ring of log
+         *  records: the owning thread fills records in place and
+         *  the write thread formats them in place. Each slot has a
+         *  sequence number telling whose turn it is, so the owning
+         *  thread needs no lock or read-modify-write. The write
+         *  thread takes records by moving the tail with a CAS, so
+         *  that the owning thread can drop the oldest record by
+         *  doing the same.
+         ***********************************************************/
+        class ThreadBuffer {
+        private:
+            struct Slot {
+                std::atomic<std::size_t> sequence;
+                LogRecord record;
+            };
+
+            std::unique_ptr<Slot[]> my_slots;
+            std::size_t my_mask;
+            // Only used by the owning thread.
+            std::size_t head;
+            alignas(64) std::atomic<std::size_t> tail;
+
+        public:
+            // Set when the owning thread exits.
+            std::atomic<bool> retired;
+
+            explicit ThreadBuffer(std::size_t capacity)
+            : my_slots(new Slot[capacity]), my_mask(capacity - 1), head(0), tail(0), retired(false) {
+                for (std::size_t i = 0; i < capacity; ++i) {
+                    my_slots[i].sequence.store(i, std::memory_order_relaxed);
+                }
+            }
+
+            // Get the slot to fill next, or nullptr if the ring is full.
+            LogRecord* claim() {
+                Slot& slot = my_slots[head & my_mask];
+                return slot.sequence.load(std::memory_order_acquire) == head ? &slot.record : nullptr;
+            }
+
+            // Hand the claimed slot over to the write thread.
+            void publish() {
+                my_slots[head & my_mask].sequence.store(head + 1);
+                ++head;
+            }
+
+            // Return true if more than half of the slots are taken.
+            bool isHalfFull() const {
+                std::size_t half = head + (my_mask + 1) / 2;
+                return my_slots[half & my_mask].sequence.load(std::memory_order_acquire) != half;
+            }
+
+            // Get the number of records the ring holds.
+            std::size_t getCapacity() const {
+                return my_mask + 1;
+            }
+
+            /***********************************************************
+             *  Drop the oldest record to make room, from the owning
+             *  thread when the ring is full. Return false if the write
+             *  thread has taken that record and is still using it.
+             ***********************************************************/
+            bool dropOldest() {
+                std::size_t oldest = head - (my_mask + 1);
+                std::size_t expected = oldest;
+                if (!tail.compare_exchange_strong(expected, oldest + 1)) {
+                    return false;
+                }
+                release(oldest);
+                return true;
+            }
+
+            // Return true if there is no published record left to take.
+            bool isEmpty() const {
+                std::size_t pos = tail.load();
+                return my_slots[pos & my_mask].sequence.load(std::memory_order_acquire) != pos + 1;
+            }
+
+            /***********************************************************
+             *  Take the oldest published record and set "pos" to its
+             *  position, or return nullptr if there is none. The slot
+             *  stays in use until it is released.
+             ***********************************************************/
+            LogRecord* take(std::size_t& pos) {
+                pos = tail.load();
+                while (true) {
+                    Slot& slot = my_slots[pos & my_mask];
+                    if (slot.sequence.load(std::memory_order_acquire) != pos + 1) {
+                        return nullptr;
+                    }
+                    if (tail.compare_exchange_weak(pos, pos + 1)) {
+                        return &slot.record;
+                    }
+                }
+            }
+
+            // Give the slot of a taken record back to the owning thread.
+            void release(std::size_t pos) {
+                my_slots[pos & my_mask].sequence.store(pos + my_mask + 1);
+            }
+        };
+
+        /***********************************************************
+         *  The buffer of a thread, kept in thread-local storage. It
+         *  is retired when the thread exits, and the write thread
+         *  frees it once it is empty.
+         ***********************************************************/
+        struct ThreadBufferRef {
+            std::shared_ptr<ThreadBuffer> buffer;
+            std::uint64_t logger_id = 0;
+            std::size_t capacity = 0;
+
+            ~ThreadBufferRef() {
+                if (buffer) {
+                    buffer->retired = true;
+                }
+            }
+        };
+
+        /***********************************************************
+         *  A thread buffer as seen by the write thread, with the
+         *  record it has taken from it but not written yet.
+         ***********************************************************/
+        struct BufferSource {
+            std::shared_ptr<ThreadBuffer> buffer;
+            LogRecord* current = nullptr;
+            std::size_t pos = 0;
+        };
+
+        /***********************************************************
+         *  How many records a call site logged in the current
+         *  second, for OverflowPolicy::Sample. Call sites are told
+         *  apart by the address of their format string.
+         ***********************************************************/
+        struct CallSite {
+            std::atomic<const char*> format{nullptr};
+            std::atomic<std::int64_t> second{0};
+            std::atomic<int> count{0};
+        };
+
+        static constexpr int call_site_bits = 10;
+        static constexpr int call_site_probes = 8;
+        // How often the write thread reports dropped records.
+        static constexpr std::chrono::seconds drop_report_interval{1};
+
+        const std::uint64_t my_id;
         std::atomic<Level> my_level;
         std::string my_log_file_path;
-        std::shared_ptr<std::ofstream> log_file_stream;
+        // The log file, a FileSink or a MappedFileSink.
+        std::shared_ptr<LogSink> file_sink;
+        std::vector<std::shared_ptr<LogSink>> my_sinks;
+        FlushPolicy flush_policy;
+        std::atomic<Level> flush_level;
         std::shared_ptr<std::thread> write_thread;
         std::atomic<bool> need_to_stop;
         mutable std::mutex my_mutex;
-        static std::shared_ptr<Logger> my_logger;
+        std::atomic<OverflowPolicy> overflow_policy;
+        std::atomic<int> sample_rate;
+        std::atomic<std::size_t> buffer_capacity;
+        std::unique_ptr<CallSite[]> call_sites;
+        std::atomic<std::uint64_t> dropped_newest;
+        std::atomic<std::uint64_t> dropped_oldest;
+        std::atomic<std::uint64_t> dropped_sampled;
+        // The buffers the write thread drains. Only it uses them.
+        std::vector<BufferSource> my_buffers;
+        // Buffers registered since the write thread last looked.
+        std::vector<std::shared_ptr<ThreadBuffer>> new_buffers;
+        std::atomic<bool> has_new_buffers;
+        std::mutex buffers_mutex;
+        // Used to put the write thread and threads with a full buffer to sleep.
+        std::mutex wake_mutex;
+        std::condition_variable writer_cond;
+        std::condition_variable space_cond;
+        std::atomic<bool> writer_sleeping;
+        std::atomic<int> waiting_producers;
+        // Used by the write thread to format timestamps.
+        LogTimeFormat time_format;
+        // Where written batches go back to once no sink holds them.
+        std::shared_ptr<BatchRecycler> batch_recycler;
+        inline static std::shared_ptr<Logger> my_logger;
+        inline static std::atomic<Logger*> my_instance{nullptr};
+        inline static std::mutex instance_mutex;
+        inline static std::atomic<std::uint64_t> next_id{1};
 
         /***********************************************************
          *  A private constructor. The parameter "level" specifies
@@ -174,7 +815,11 @@ namespace acht {
          *  path where the log records are send to.
          ***********************************************************/
         Logger(Level level, const std::string& log_file_path = "out.log")
-        : my_level(level), log_queue(100), my_log_file_path(log_file_path), need_to_stop(false) {
+        : my_id(next_id++), my_level(level), my_log_file_path(log_file_path),
+          flush_level(flush_policy.flush_level), need_to_stop(false), overflow_policy(OverflowPolicy::Block),
+          sample_rate(100), buffer_capacity(512), call_sites(new CallSite[1 << call_site_bits]),
+          dropped_newest(0), dropped_oldest(0), dropped_sampled(0), has_new_buffers(false),
+          writer_sleeping(false), waiting_producers(0), batch_recycler(std::make_shared<BatchRecycler>()) {
             setFileStream(log_file_path);
             write_thread = std::make_shared<std::thread>([this] {
                 runWriteThread();
@@ -182,32 +827,297 @@ namespace acht {
         }
 
         /***********************************************************
-         *  Set file stream with the log file path.
+         *  Create the logger. The instance mutex must be held.
          ***********************************************************/
-        bool setFileStream(const std::string& log_file_path) {
-            log_file_stream = std::make_shared<std::ofstream>();
-            log_file_stream->open(log_file_path, std::ofstream::app);
+        static void createLogger(Level level) {
+            my_logger = std::shared_ptr<Logger>(new Logger(level));
+            my_instance = my_logger.get();
+        }
 
-            if (log_file_stream->is_open()) {
+        /***********************************************************
+         *  Open the log file with the log file path. The file sink
+         *  must be reset first.
+         ***********************************************************/
+        bool setFileStream(const std::string& log_file_path) {
+            auto sink = std::make_shared<FileSink>(log_file_path);
+            if (sink->isOpen()) {
+                file_sink = std::move(sink);
                 return true;
             }
             else {
                 std::cerr << "Failed to open log file: " << log_file_path << std::endl;
-                log_file_stream = nullptr;
                 return false;
             }
         }
 
+        // Return true if the log file is memory-mapped. my_mutex must be held.
+        bool isMapped() const {
+            return dynamic_cast<MappedFileSink*>(file_sink.get()) != nullptr;
+        }
+
+        /***********************************************************
+         *  Write a batch of log records to the log file and the
+         *  other sinks, formatting it first if one of them needs
+         *  the text.
+         ***********************************************************/
+        void writeBatch(const std::shared_ptr<LogBatch>& batch) {
+            std::lock_guard<std::mutex> lock(my_mutex);
+            if (batch->isEmpty()) {
+                return;
+            }
+            bool needs_text = (file_sink && file_sink->needsText())
+                || std::any_of(my_sinks.begin(), my_sinks.end(), [](const std::shared_ptr<LogSink>& sink) {
+                       return sink->needsText();
+                   });
+            if (needs_text) {
+                formatBatch(*batch);
+            }
+            std::shared_ptr<const LogBatch> shared = batch;
+            if (file_sink) {
+                file_sink->write(shared);
+            }
+            for (auto& sink : my_sinks) {
+                sink->write(shared);
+            }
+        }
+
+        /***********************************************************
+         *  Get the buffer of the calling thread, registering a new
+         *  one with the write thread on first use.
+         ***********************************************************/
+        ThreadBuffer& getThreadBuffer() {
+            thread_local ThreadBufferRef ref;
+            std::size_t capacity = buffer_capacity.load(std::memory_order_relaxed);
+            if (ref.logger_id != my_id || ref.capacity != capacity) {
+                // The last buffer, if any, belongs to a destroyed
+                // logger or has the wrong size
+                if (ref.buffer) {
+                    ref.buffer->retired = true;
+                }
+                ref.buffer = std::make_shared<ThreadBuffer>(capacity);
+                ref.logger_id = my_id;
+                ref.capacity = capacity;
+                std::lock_guard<std::mutex> lock(buffers_mutex);
+                new_buffers.push_back(ref.buffer);
+                has_new_buffers = true;
+            }
+            return *ref.buffer;
+        }
+
+        /***********************************************************
+         *  Count a record of a call site for OverflowPolicy::Sample
+         *  and return false if the call site has used up its rate
+         *  for this second. The counts are reset racily, which at
+         *  worst lets a few more records through. If the call site
+         *  table is crowded, the record is let through.
+         ***********************************************************/
+        bool takeSample(const char* format, std::int64_t time) {
+            std::uint64_t hash = static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(format));
+            hash = (hash * 0x9E3779B97F4A7C15ull) >> (64 - call_site_bits);
+            std::int64_t second = time / 1000000000;
+            for (int probe = 0; probe < call_site_probes; ++probe) {
+                CallSite& site = call_sites[(hash + probe) & ((1 << call_site_bits) - 1)];
+                const char* owner = site.format.load(std::memory_order_acquire);
+                if (owner == nullptr && site.format.compare_exchange_strong(owner, format)) {
+                    owner = format;
+                }
+                if (owner == format) {
+                    if (site.second.load(std::memory_order_relaxed) != second
+                            && site.second.exchange(second, std::memory_order_relaxed) != second) {
+                        site.count.store(0, std::memory_order_relaxed);
+                    }
+                    return site.count.fetch_add(1, std::memory_order_relaxed) < sample_rate.load(std::memory_order_relaxed);
+                }
+            }
+            return true;
+        }
+
+        /***********************************************************
+         *  Handle a full buffer as the overflow policy says. Return
+         *  the slot to fill, or nullptr if the record is dropped.
+         ***********************************************************/
+        LogRecord* overflow(ThreadBuffer& buffer, OverflowPolicy policy) {
+            if (policy == OverflowPolicy::Block) {
+                return waitForSpace(buffer);
+            }
+            if (policy == OverflowPolicy::DropOldest && buffer.dropOldest()) {
+                dropped_oldest.fetch_add(1, std::memory_order_relaxed);
+                return buffer.claim();
+            }
+            dropped_newest.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+
+        /***********************************************************
+         *  Wait until the write thread frees a slot of the calling
+         *  thread's buffer and return it. Return nullptr if the
+         *  logger was stopped.
+         ***********************************************************/
+        LogRecord* waitForSpace(ThreadBuffer& buffer) {
+            std::unique_lock<std::mutex> lock(wake_mutex);
+            ++waiting_producers;
+            writer_cond.notify_one();
+            LogRecord* record = nullptr;
+            while (!need_to_stop && (record = buffer.claim()) == nullptr) {
+                space_cond.wait_for(lock, std::chrono::milliseconds(10));
+            }
+            --waiting_producers;
+            return record;
+        }
+
+        /***********************************************************
+         *  Wake up the write thread.
+         ***********************************************************/
+        void wakeWriteThread() {
+            std::lock_guard<std::mutex> lock(wake_mutex);
+            writer_cond.notify_one();
+        }
+
+        /***********************************************************
+         *  Take over newly registered buffers, and free the buffers
+         *  of exited threads once they are drained.
+         ***********************************************************/
+        void updateBuffers() {
+            if (has_new_buffers) {
+                std::lock_guard<std::mutex> lock(buffers_mutex);
+                for (auto& buffer : new_buffers) {
+                    my_buffers.push_back(BufferSource{std::move(buffer)});
+                }
+                new_buffers.clear();
+                has_new_buffers = false;
+            }
+            my_buffers.erase(std::remove_if(my_buffers.begin(), my_buffers.end(),
+                [](const BufferSource& source) {
+                    return source.current == nullptr && source.buffer->retired.load(std::memory_order_acquire)
+                        && source.buffer->isEmpty();
+                }), my_buffers.end());
+        }
+
+        /***********************************************************
+         *  Move the records of all thread buffers into "out" in the
+         *  order of their timestamps, until "out" holds "limit"
+         *  bytes of records or the buffers are empty. Return true if a record
+         *  was at least as severe as "flush_level". The oldest
+         *  record is looked up by a linear scan, as there are only
+         *  as many buffers as logging threads.
+         ***********************************************************/
+        bool drainBuffers(LogBatch& out, std::size_t limit, Level flush_level) {
+            bool urgent = false;
+            while (out.records.size() < limit) {
+                BufferSource* oldest = nullptr;
+                for (auto& source : my_buffers) {
+                    if (source.current == nullptr) {
+                        source.current = source.buffer->take(source.pos);
+                    }
+                    if (source.current != nullptr && (oldest == nullptr || source.current->time < oldest->current->time)) {
+                        oldest = &source;
+                    }
+                }
+                if (oldest == nullptr) {
+                    break;
+                }
+                const LogRecord& record = *oldest->current;
+                out.addRecord(record.level, record.time, record.format, record.getArgs(), record.size);
+                urgent = urgent || record.level <= flush_level;
+                oldest->buffer->release(oldest->pos);
+                oldest->current = nullptr;
+            }
+            if (waiting_producers.load() > 0) {
+                std::lock_guard<std::mutex> lock(wake_mutex);
+                space_cond.notify_all();
+            }
+            return urgent;
+        }
+
+        /***********************************************************
+         *  Sleep until "deadline" unless there is something to do.
+         ***********************************************************/
+        void waitForRecords(std::chrono::steady_clock::time_point deadline) {
+            std::unique_lock<std::mutex> lock(wake_mutex);
+            writer_sleeping = true;
+            bool idle = !need_to_stop && !has_new_buffers && waiting_producers.load() == 0
+                && std::none_of(my_buffers.begin(), my_buffers.end(),
+                    [](const BufferSource& source) {
+                        return source.current != nullptr || !source.buffer->isEmpty();
+                    });
+            if (idle) {
+                writer_cond.wait_until(lock, deadline);
+            }
+            writer_sleeping = false;
+        }
+
+        /***********************************************************
+         *  Add a record saying how many records were dropped since
+         *  the last report, if any.
+         ***********************************************************/
+        void reportDrops(LogBatch& out, std::uint64_t& reported) {
+            DropCounts counts = getDropCounts();
+            if (counts.getTotal() == reported) {
+                return;
+            }
+            char args[4 * 9];
+            char* end = args;
+            detail::encodeArgs(end, counts.getTotal() - reported, counts.newest, counts.oldest, counts.sampled);
+            out.addRecord(Level::WARN, std::chrono::duration_cast<std::chrono::nanoseconds>(
+                              std::chrono::system_clock::now().time_since_epoch()).count(),
+                          "{} log records dropped (in total: {} newest, {} oldest, {} sampled)",
+                          args, static_cast<std::size_t>(end - args));
+            reported = counts.getTotal();
+        }
+
+        /***********************************************************
+         *  Replace a written batch with an empty one. A batch that
+         *  an asynchronous sink still holds is reused once the sink
+         *  lets go of it.
+         ***********************************************************/
+        void nextBatch(std::shared_ptr<LogBatch>& batch) {
+            batch = nullptr;
+            batch = batch_recycler->get();
+        }
+
         /***********************************************************
          *  Run the write thread until logger is stopped.
-         *  Write every log record it takes from the log queue,
-         *  waiting if the task queue is empty.
+         *  Collect the records of the thread buffers into a batch,
+         *  and write the batch as the flush policy says.
+         *  When the logger is stopped, write everything that is
+         *  left first.
          ***********************************************************/
         void runWriteThread() {
-            while (!need_to_stop) {
-                std::string log;
-                if (log_queue.take(log) && log_file_stream) {
-                    *log_file_stream << log << std::endl;
+            std::shared_ptr<LogBatch> batch = batch_recycler->get();
+            std::chrono::steady_clock::time_point oldest;
+            std::chrono::steady_clock::time_point next_report = std::chrono::steady_clock::now();
+            std::uint64_t reported_drops = getDropCounts().getTotal();
+            while (true) {
+                FlushPolicy policy = getFlushPolicy();
+                bool stopping = need_to_stop;
+                updateBuffers();
+
+                std::size_t before = batch->records.size();
+                if (before == 0) {
+                    batch->records.reserve(policy.buffer_size);
+                }
+                bool urgent = drainBuffers(*batch, stopping ? std::string::npos : policy.buffer_size,
+                                           policy.flush_level);
+                bool drained = batch->records.size() > before;
+                auto now = std::chrono::steady_clock::now();
+                if (now >= next_report || stopping) {
+                    reportDrops(*batch, reported_drops);
+                    next_report = now + drop_report_interval;
+                }
+                if (before == 0 && batch->records.size() > 0) {
+                    oldest = now;
+                }
+
+                if (!batch->isEmpty() && (stopping || urgent || batch->records.size() >= policy.buffer_size
+                        || now >= oldest + policy.interval)) {
+                    writeBatch(batch);
+                    nextBatch(batch);
+                }
+                if (stopping) {
+                    break;
+                }
+                if (!drained) {
+                    waitForRecords(batch->isEmpty() ? now + policy.interval : oldest + policy.interval);
                 }
             }
         }
@@ -215,42 +1125,69 @@ namespace acht {
         /***********************************************************
          *  Convert a level to a string.
          ***********************************************************/
-        std::string levelToString(Level level) const {
-            switch(level) {
-                case Level::FATAL:
-                    return "FATAL";
-                case Level::ERROR:
-                    return "ERROR";
-                case Level::WARN:
-                    return "WARN";
-                case Level::INFO:
-                    return "INFO";
-                case Level::DEBUG:
-                    return "DEBUG";
-            }
+        static const char* levelToString(Level level) {
+            return logLevelName(level);
         }
 
         /***********************************************************
-         *  Get the current time as a string.
+         *  Format the records of a batch as lines of text.
          ***********************************************************/
-        std::string getCurrentTime() const {
-            auto time = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
-            std::stringstream t_stream;
-            t_stream << std::put_time(std::localtime(&time), "%Y-%m-%d %X");
-            return t_stream.str();
+        void formatBatch(LogBatch& batch) {
+            batch.forEachRecord([&](const LogBatch::Record& record) {
+                std::size_t offset = batch.text.size();
+                appendLogLine(batch.text, time_format, levelToString(record.level), record.time,
+                              record.format, record.args, record.size);
+                batch.addLine(offset, record.level);
+            });
         }
     };
 
-    std::shared_ptr<Logger> Logger::my_logger = nullptr;
+    static_assert(static_cast<int>(Logger::Level::DEBUG) == ACHT_LOG_LEVEL_DEBUG,
+                  "ACHT_LOG_LEVEL_X must match Logger::Level");
 
     /***********************************************************
     *  Log messages to the log file.
+    *  Either a message or a format string followed by its
+    *  arguments, e.g. LOG_INFO("took {} ms", elapsed). The
+    *  arguments are only evaluated if the level is enabled.
+    *  Whether the format is a string literal is told from its
+    *  spelling; only then is the formatting left to the write
+    *  thread.
     ***********************************************************/
-    #define LOG_FATAL(LOG_MESSAGE) Logger::getLogger()->write(acht::Logger::Level::FATAL, LOG_MESSAGE);
-    #define LOG_ERROR(LOG_MESSAGE) Logger::getLogger()->write(acht::Logger::Level::ERROR, LOG_MESSAGE);
-    #define LOG_WARN(LOG_MESSAGE) Logger::getLogger()->write(acht::Logger::Level::WARN, LOG_MESSAGE);
-    #define LOG_INFO(LOG_MESSAGE) Logger::getLogger()->write(acht::Logger::Level::INFO, LOG_MESSAGE);
-    #define LOG_DEBUG(LOG_MESSAGE) Logger::getLogger()->write(acht::Logger::Level::DEBUG, LOG_MESSAGE);
+    #define ACHT_LOG_SPELLING(FIRST, ...) #FIRST
+    #define ACHT_LOG_IS_LITERAL(...) (ACHT_LOG_SPELLING(__VA_ARGS__, ~)[0] == '"')
+    #define ACHT_LOG_AT(LEVEL, ...) Logger::isEnabled(LEVEL) \
+        ? acht::Logger::getInstance().logChecked<ACHT_LOG_IS_LITERAL(__VA_ARGS__)>(LEVEL, __VA_ARGS__) : void()
+
+    #if ACHT_LOG_MIN_LEVEL >= ACHT_LOG_LEVEL_FATAL
+    #define LOG_FATAL(...) ACHT_LOG_AT(acht::Logger::Level::FATAL, __VA_ARGS__);
+    #else
+    #define LOG_FATAL(...) Logger::discard();
+    #endif
+
+    #if ACHT_LOG_MIN_LEVEL >= ACHT_LOG_LEVEL_ERROR
+    #define LOG_ERROR(...) ACHT_LOG_AT(acht::Logger::Level::ERROR, __VA_ARGS__);
+    #else
+    #define LOG_ERROR(...) Logger::discard();
+    #endif
+
+    #if ACHT_LOG_MIN_LEVEL >= ACHT_LOG_LEVEL_WARN
+    #define LOG_WARN(...) ACHT_LOG_AT(acht::Logger::Level::WARN, __VA_ARGS__);
+    #else
+    #define LOG_WARN(...) Logger::discard();
+    #endif
+
+    #if ACHT_LOG_MIN_LEVEL >= ACHT_LOG_LEVEL_INFO
+    #define LOG_INFO(...) ACHT_LOG_AT(acht::Logger::Level::INFO, __VA_ARGS__);
+    #else
+    #define LOG_INFO(...) Logger::discard();
+    #endif
+
+    #if ACHT_LOG_MIN_LEVEL >= ACHT_LOG_LEVEL_DEBUG
+    #define LOG_DEBUG(...) ACHT_LOG_AT(acht::Logger::Level::DEBUG, __VA_ARGS__);
+    #else
+    #define LOG_DEBUG(...) Logger::discard();
+    #endif
 }
 
 #endif
\ No newline at end of file
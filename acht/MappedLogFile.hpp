@@ -0,0 +1,404 @@
+#ifndef _MAPPED_LOG_FILE_HPP_
+#define _MAPPED_LOG_FILE_HPP_
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define ACHT_HAS_MMAP 1
+#endif
+
+namespace acht {
+
+    /***********************************************************
+     *  When a MappedLogFile starts a new file. A file is rotated
+     *  before it would grow beyond "max_file_size" bytes, or once
+     *  it is "max_age" old; zero turns a limit off. Rotated files
+     *  are kept as "path.1" (the newest) up to "path.max_files",
+     *  and older ones are deleted. The mapping grows by
+     *  "chunk_size" bytes at a time.
+     ***********************************************************/
+    struct RotationPolicy {
+        std::size_t max_file_size;
+        std::chrono::seconds max_age;
+        int max_files;
+        std::size_t chunk_size;
+
+        RotationPolicy(std::size_t max_file_size = 64 * 1024 * 1024,
+                       std::chrono::seconds max_age = std::chrono::seconds(0),
+                       int max_files = 5,
+                       std::size_t chunk_size = 4 * 1024 * 1024)
+        : max_file_size(max_file_size), max_age(max_age), max_files(max_files), chunk_size(chunk_size) {}
+    };
+
+    /***********************************************************
+     *  A log file written through a memory mapping. Writing is a
+     *  memcpy into the mapping; a system call is only needed
+     *  when the mapping has to grow by another chunk. The file
+     *  is rotated as the rotation policy says.
+     *
+     *  The expensive part of a rotation happens on a background
+     *  thread: it creates and maps the next file ahead of time,
+     *  and trims, renames and deletes old files afterwards. If
+     *  the next file is not ready yet, writing simply goes on in
+     *  the current file.
+     *
+     *  The live file is padded with zero bytes up to the end of
+     *  the mapping; the padding is cut off when the file is
+     *  rotated or closed. Only one thread may write at a time.
+     *  Memory mapping needs a POSIX system; elsewhere isOpen()
+     *  returns false.
+     ***********************************************************/
+    class MappedLogFile {
+    private:
+        struct Mapping {
+            int fd = -1;
+            char* data = nullptr;
+            std::size_t mapped = 0;
+            std::size_t used = 0;
+            std::chrono::steady_clock::time_point opened;
+        };
+
+        std::string my_path;
+        RotationPolicy my_policy;
+        Mapping current;
+        // The next file, once the background thread has made it.
+        Mapping prepared;
+        bool has_prepared;
+        // Files to trim and rename, oldest first.
+        std::vector<Mapping> retired;
+        bool need_to_stop;
+        std::mutex my_mutex;
+        std::condition_variable my_cond;
+        std::thread background_thread;
+
+        std::string nextPath() const {
+            return my_path + ".next";
+        }
+
+        std::string rotatedPath(int index) const {
+            return my_path + "." + std::to_string(index);
+        }
+
+        /***********************************************************
+         *  Open a file and map its first chunk. Return false if the
+         *  file cannot be opened or mapped.
+         ***********************************************************/
+        bool openMapping(const std::string& path, Mapping& mapping, bool append) {
+#if defined(ACHT_HAS_MMAP)
+            int fd = ::open(path.c_str(), O_RDWR | O_CREAT | (append ? 0 : O_TRUNC), 0644);
+            if (fd < 0) {
+                return false;
+            }
+            mapping.fd = fd;
+            mapping.used = 0;
+            if (append) {
+                struct stat info;
+                if (::fstat(fd, &info) == 0) {
+                    mapping.used = static_cast<std::size_t>(info.st_size);
+                }
+                // Skip the padding a crashed process may have left.
+                mapping.used = trimmedSize(mapping);
+            }
+            mapping.opened = std::chrono::steady_clock::now();
+            if (!remap(mapping, mapping.used + 1)) {
+                ::close(fd);
+                mapping = Mapping();
+                return false;
+            }
+            return true;
+#else
+            (void)path;
+            (void)mapping;
+            (void)append;
+            return false;
+#endif
+        }
+
+        /***********************************************************
+         *  Get the size of an existing file without zero padding at
+         *  its end.
+         ***********************************************************/
+        std::size_t trimmedSize(const Mapping& mapping) const {
+#if defined(ACHT_HAS_MMAP)
+            std::size_t size = mapping.used;
+            char block[4096];
+            while (size > 0) {
+                std::size_t length = std::min(size, sizeof(block));
+                if (::pread(mapping.fd, block, length, static_cast<off_t>(size - length)) != static_cast<ssize_t>(length)) {
+                    break;
+                }
+                std::size_t end = length;
+                while (end > 0 && block[end - 1] == '\0') {
+                    --end;
+                }
+                size -= length - end;
+                if (end > 0) {
+                    break;
+                }
+            }
+            return size;
+#else
+            return mapping.used;
+#endif
+        }
+
+        /***********************************************************
+         *  Grow a file to "size" bytes, with disk space reserved for
+         *  the bytes from "from" on. A page of the mapping without
+         *  disk space behind it would raise SIGBUS when it is first
+         *  written on a full disk, so return false instead if the
+         *  space is not there. Where space cannot be reserved ahead
+         *  of time, the file is only made longer.
+         ***********************************************************/
+        static bool reserve(int fd, std::size_t from, std::size_t size) {
+#if defined(ACHT_HAS_MMAP)
+#if defined(__linux__) || defined(__FreeBSD__)
+            int error = ::posix_fallocate(fd, static_cast<off_t>(from), static_cast<off_t>(size - from));
+            if (error == 0) {
+                // The file may have been longer; keep the mapped size.
+                return ::ftruncate(fd, static_cast<off_t>(size)) == 0;
+            }
+            if (error != EINVAL && error != EOPNOTSUPP) {
+                return false;
+            }
+#else
+            (void)from;
+#endif
+            return ::ftruncate(fd, static_cast<off_t>(size)) == 0;
+#else
+            (void)fd;
+            (void)from;
+            (void)size;
+            return false;
+#endif
+        }
+
+        /***********************************************************
+         *  Grow the file and its mapping, in whole chunks, so that
+         *  at least "size" bytes fit. Return false if there is no
+         *  disk space for them.
+         ***********************************************************/
+        bool remap(Mapping& mapping, std::size_t size) {
+#if defined(ACHT_HAS_MMAP)
+            std::size_t chunk = std::max<std::size_t>(my_policy.chunk_size, 4096);
+            std::size_t mapped = (size + chunk - 1) / chunk * chunk;
+            if (!reserve(mapping.fd, std::min(mapping.mapped, mapped), mapped)) {
+                return false;
+            }
+            void* data = ::mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_SHARED, mapping.fd, 0);
+            if (data == MAP_FAILED) {
+                return false;
+            }
+            if (mapping.data != nullptr) {
+                ::munmap(mapping.data, mapping.mapped);
+            }
+            mapping.data = static_cast<char*>(data);
+            mapping.mapped = mapped;
+            return true;
+#else
+            (void)mapping;
+            (void)size;
+            return false;
+#endif
+        }
+
+        /***********************************************************
+         *  Unmap a file, cut off its padding and close it.
+         ***********************************************************/
+        static void closeMapping(Mapping& mapping) {
+#if defined(ACHT_HAS_MMAP)
+            if (mapping.data != nullptr) {
+                ::munmap(mapping.data, mapping.mapped);
+            }
+            if (mapping.fd >= 0) {
+                if (::ftruncate(mapping.fd, static_cast<off_t>(mapping.used)) != 0) {
+                    // Keep the padding rather than fail.
+                }
+                ::close(mapping.fd);
+            }
+#endif
+            mapping = Mapping();
+        }
+
+        /***********************************************************
+         *  Return true if the current file has to be rotated before
+         *  "size" more bytes are written to it.
+         ***********************************************************/
+        bool needRotation(std::size_t size) const {
+            if (current.used == 0) {
+                return false;
+            }
+            if (my_policy.max_file_size > 0 && current.used + size > my_policy.max_file_size) {
+                return true;
+            }
+            return my_policy.max_age > std::chrono::seconds(0)
+                && std::chrono::steady_clock::now() - current.opened >= my_policy.max_age;
+        }
+
+        /***********************************************************
+         *  Switch to the prepared file if there is one, and leave
+         *  the old file to the background thread.
+         ***********************************************************/
+        void rotate() {
+            std::lock_guard<std::mutex> lock(my_mutex);
+            if (!has_prepared) {
+                return;
+            }
+            retired.push_back(current);
+            current = prepared;
+            current.opened = std::chrono::steady_clock::now();
+            prepared = Mapping();
+            has_prepared = false;
+            my_cond.notify_one();
+        }
+
+        /***********************************************************
+         *  Shift the rotated files by one, deleting the oldest, and
+         *  move the live file to "path.1".
+         ***********************************************************/
+        void shiftFiles() {
+            if (my_policy.max_files <= 0) {
+                std::remove(my_path.c_str());
+                return;
+            }
+            std::remove(rotatedPath(my_policy.max_files).c_str());
+            for (int index = my_policy.max_files - 1; index >= 1; --index) {
+                std::rename(rotatedPath(index).c_str(), rotatedPath(index + 1).c_str());
+            }
+            std::rename(my_path.c_str(), rotatedPath(1).c_str());
+        }
+
+        /***********************************************************
+         *  Run the background thread until the file is closed:
+         *  finish rotated files and keep the next file ready.
+         ***********************************************************/
+        void runBackgroundThread() {
+            std::unique_lock<std::mutex> lock(my_mutex);
+            while (true) {
+                my_cond.wait(lock, [this] {
+                    return need_to_stop || !retired.empty() || !has_prepared;
+                });
+                if (need_to_stop) {
+                    break;
+                }
+
+                if (!retired.empty()) {
+                    std::vector<Mapping> files;
+                    files.swap(retired);
+                    lock.unlock();
+                    for (Mapping& file : files) {
+                        closeMapping(file);
+                        shiftFiles();
+                        // The file being written becomes the live file.
+                        std::rename(nextPath().c_str(), my_path.c_str());
+                    }
+                    lock.lock();
+                }
+
+                if (!has_prepared) {
+                    lock.unlock();
+                    Mapping next;
+                    bool opened = openMapping(nextPath(), next, false);
+                    lock.lock();
+                    if (!opened) {
+                        // Try again later rather than spin.
+                        my_cond.wait_for(lock, std::chrono::seconds(1), [this] {
+                            return need_to_stop;
+                        });
+                        continue;
+                    }
+                    prepared = next;
+                    has_prepared = true;
+                }
+            }
+        }
+
+    public:
+        /***********************************************************
+         *  Open (or append to) the log file at "path".
+         ***********************************************************/
+        explicit MappedLogFile(const std::string& path, const RotationPolicy& policy = RotationPolicy())
+        : my_path(path), my_policy(policy), has_prepared(false), need_to_stop(false) {
+            if (openMapping(my_path, current, true)) {
+                background_thread = std::thread([this] {
+                    runBackgroundThread();
+                });
+            }
+        }
+
+        // No copy
+        MappedLogFile(const MappedLogFile&) = delete;
+
+        // No assignment
+        MappedLogFile& operator=(const MappedLogFile&) = delete;
+
+        /***********************************************************
+         *  Destructor. Finish all files and remove the spare one.
+         ***********************************************************/
+        ~MappedLogFile() {
+            if (background_thread.joinable()) {
+                {
+                    std::lock_guard<std::mutex> lock(my_mutex);
+                    need_to_stop = true;
+                    my_cond.notify_one();
+                }
+                background_thread.join();
+            }
+            for (Mapping& file : retired) {
+                closeMapping(file);
+                shiftFiles();
+                std::rename(nextPath().c_str(), my_path.c_str());
+            }
+            if (has_prepared) {
+                closeMapping(prepared);
+                std::remove(nextPath().c_str());
+            }
+            closeMapping(current);
+        }
+
+        // Return true if the file could be opened and mapped.
+        bool isOpen() const {
+            return current.data != nullptr;
+        }
+
+        // Get the path of the live file.
+        const std::string& getPath() const {
+            return my_path;
+        }
+
+        /***********************************************************
+         *  Append "size" bytes to the file, rotating it first if it
+         *  is due. Return false if the mapping could not grow, such
+         *  as when the disk is full.
+         ***********************************************************/
+        bool write(const char* data, std::size_t size) {
+            if (!isOpen()) {
+                return false;
+            }
+            if (needRotation(size)) {
+                rotate();
+            }
+            if (current.used + size > current.mapped && !remap(current, current.used + size)) {
+                return false;
+            }
+            std::memcpy(current.data + current.used, data, size);
+            current.used += size;
+            return true;
+        }
+    };
+}
+
+#endif
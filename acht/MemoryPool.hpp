@@ -0,0 +1,293 @@
+#ifndef _MEMORY_POOL_HPP_
+#define _MEMORY_POOL_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <mutex>
+#include <vector>
+
+namespace acht {
+
+    /***********************************************************
+     *  A pool of memory blocks in a few size classes, used for
+     *  queue nodes, task closures and log record buffers so that
+     *  a program in steady state does not call the global heap.
+     *
+     *  Every thread caches free blocks of each size class, so
+     *  allocating and freeing a block usually takes no lock. A
+     *  thread that frees more blocks than it allocates hands
+     *  half of its cache back to the pool of that size class,
+     *  and a thread gives all of its cache back when it exits.
+     *  The pool itself gets memory in slabs, which it carves
+     *  into blocks and never gives back.
+     *
+     *  Sizes above "max_size" and over-aligned types go to the
+     *  global heap. Define ACHT_DISABLE_POOL to send everything
+     *  there, e.g. to let a memory checker see every block.
+     ***********************************************************/
+    class MemoryPool {
+    public:
+        static constexpr std::size_t min_size = 16;
+        static constexpr std::size_t max_size = 4096;
+        static constexpr std::size_t alignment = alignof(std::max_align_t);
+
+        // Get the size of the blocks a request of "size" bytes gets.
+        static constexpr std::size_t blockSize(std::size_t size) {
+            std::size_t block = min_size;
+            while (block < size) {
+                block *= 2;
+            }
+            return block;
+        }
+
+        /***********************************************************
+         *  Get a block of at least "size" bytes, aligned for any
+         *  standard type.
+         ***********************************************************/
+        static void* allocate(std::size_t size) {
+#if !defined(ACHT_DISABLE_POOL)
+            if (size <= max_size) {
+                int index = classIndex(size);
+                ThreadCache& cache = threadCache();
+                if (cache.alive) {
+                    FreeList& list = cache.lists[index];
+                    if (list.head == nullptr) {
+                        central(index).fill(list);
+                    }
+                    Block* block = list.head;
+                    list.head = block->next;
+                    --list.count;
+                    return block;
+                }
+                return central(index).take();
+            }
+#endif
+            return ::operator new(size);
+        }
+
+        /***********************************************************
+         *  Give back a block got with allocate(size).
+         ***********************************************************/
+        static void deallocate(void* pointer, std::size_t size) noexcept {
+            if (pointer == nullptr) {
+                return;
+            }
+#if !defined(ACHT_DISABLE_POOL)
+            if (size <= max_size) {
+                int index = classIndex(size);
+                Block* block = static_cast<Block*>(pointer);
+                ThreadCache& cache = threadCache();
+                if (cache.alive) {
+                    FreeList& list = cache.lists[index];
+                    block->next = list.head;
+                    list.head = block;
+                    if (++list.count > cacheLimit(index)) {
+                        central(index).drain(list, list.count / 2);
+                    }
+                    return;
+                }
+                central(index).give(block);
+                return;
+            }
+#else
+            (void)size;
+#endif
+            ::operator delete(pointer);
+        }
+
+    private:
+        static constexpr int class_count = 9;
+        // Slabs hold at least this many bytes.
+        static constexpr std::size_t slab_size = 64 * 1024;
+        // The bytes of free blocks a thread keeps per size class.
+        static constexpr std::size_t cache_bytes = 32 * 1024;
+
+        struct Block {
+            Block* next;
+        };
+
+        struct FreeList {
+            Block* head;
+            std::size_t count;
+        };
+
+        /***********************************************************
+         *  The free blocks a thread keeps. It is trivially
+         *  destructible, so it can be used while the thread's other
+         *  thread-local objects are destroyed; once the cache has
+         *  been handed back, "alive" is false and blocks go to the
+         *  pools directly.
+         ***********************************************************/
+        struct ThreadCache {
+            FreeList lists[class_count];
+            bool alive;
+            bool registered;
+        };
+
+        // The pool of one size class.
+        class Central {
+        private:
+            std::mutex my_mutex;
+            Block* free_blocks = nullptr;
+            std::size_t block_size = 0;
+            std::vector<char*> slabs;
+
+            // Carve a new slab into free blocks. The lock must be held.
+            void grow() {
+                std::size_t count = slab_size / block_size > 32 ? slab_size / block_size : 32;
+                char* slab = static_cast<char*>(::operator new(count * block_size));
+                slabs.push_back(slab);
+                for (std::size_t i = count; i > 0; --i) {
+                    Block* block = reinterpret_cast<Block*>(slab + (i - 1) * block_size);
+                    block->next = free_blocks;
+                    free_blocks = block;
+                }
+            }
+
+        public:
+            void setBlockSize(std::size_t size) {
+                block_size = size;
+            }
+
+            // Move a batch of blocks into an empty thread cache list.
+            void fill(FreeList& list) {
+                std::size_t batch = cache_bytes / block_size / 2;
+                std::lock_guard<std::mutex> lock(my_mutex);
+                for (std::size_t i = 0; i < batch; ++i) {
+                    if (free_blocks == nullptr) {
+                        grow();
+                    }
+                    Block* block = free_blocks;
+                    free_blocks = block->next;
+                    block->next = list.head;
+                    list.head = block;
+                    ++list.count;
+                }
+            }
+
+            // Move "count" blocks from a thread cache list back.
+            void drain(FreeList& list, std::size_t count) {
+                std::lock_guard<std::mutex> lock(my_mutex);
+                for (std::size_t i = 0; i < count && list.head != nullptr; ++i) {
+                    Block* block = list.head;
+                    list.head = block->next;
+                    --list.count;
+                    block->next = free_blocks;
+                    free_blocks = block;
+                }
+            }
+
+            void* take() {
+                std::lock_guard<std::mutex> lock(my_mutex);
+                if (free_blocks == nullptr) {
+                    grow();
+                }
+                Block* block = free_blocks;
+                free_blocks = block->next;
+                return block;
+            }
+
+            void give(Block* block) {
+                std::lock_guard<std::mutex> lock(my_mutex);
+                block->next = free_blocks;
+                free_blocks = block;
+            }
+        };
+
+        // Hands the cache of a thread back when the thread exits.
+        struct CacheReleaser {
+            ~CacheReleaser() {
+                ThreadCache& cache = threadCache();
+                cache.alive = false;
+                for (int index = 0; index < class_count; ++index) {
+                    central(index).drain(cache.lists[index], cache.lists[index].count);
+                }
+            }
+        };
+
+        static int classIndex(std::size_t size) {
+            int index = 0;
+            for (std::size_t block = min_size; block < size; block *= 2) {
+                ++index;
+            }
+            return index;
+        }
+
+        static std::size_t cacheLimit(int index) {
+            return cache_bytes / (min_size << index);
+        }
+
+        /***********************************************************
+         *  Get the pool of a size class. The pools are never
+         *  destroyed, so that blocks can be freed at any time
+         *  during exit.
+         ***********************************************************/
+        static Central& central(int index) {
+            static Central* centrals = [] {
+                Central* pools = new Central[class_count];
+                for (int i = 0; i < class_count; ++i) {
+                    pools[i].setBlockSize(min_size << i);
+                }
+                return pools;
+            }();
+            return centrals[index];
+        }
+
+        static ThreadCache& threadCache() {
+            thread_local ThreadCache cache = {};
+            if (!cache.registered) {
+                cache.registered = true;
+                cache.alive = true;
+                // Registered on first use, destroyed when the thread exits
+                thread_local CacheReleaser releaser;
+                (void)releaser;
+            }
+            return cache;
+        }
+
+        static_assert(min_size << (class_count - 1) == max_size, "size classes must end at max_size");
+    };
+
+    /***********************************************************
+     *  A standard allocator drawing from the MemoryPool, for
+     *  containers that allocate as they go (such as std::deque).
+     ***********************************************************/
+    template <typename T>
+    class PoolAllocator {
+    public:
+        using value_type = T;
+
+        PoolAllocator() noexcept = default;
+
+        template <typename U>
+        PoolAllocator(const PoolAllocator<U>&) noexcept {}
+
+        T* allocate(std::size_t n) {
+            if (alignof(T) > MemoryPool::alignment) {
+                return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(alignof(T))));
+            }
+            return static_cast<T*>(MemoryPool::allocate(n * sizeof(T)));
+        }
+
+        void deallocate(T* pointer, std::size_t n) noexcept {
+            if (alignof(T) > MemoryPool::alignment) {
+                ::operator delete(pointer, std::align_val_t(alignof(T)));
+                return;
+            }
+            MemoryPool::deallocate(pointer, n * sizeof(T));
+        }
+
+        template <typename U>
+        bool operator==(const PoolAllocator<U>&) const noexcept {
+            return true;
+        }
+
+        template <typename U>
+        bool operator!=(const PoolAllocator<U>&) const noexcept {
+            return false;
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,244 @@
+#ifndef _METRICS_HPP_
+#define _METRICS_HPP_
+
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+
+namespace acht {
+
+    /***********************************************************
+     *  A histogram of values (latencies in nanoseconds) with
+     *  HDR-style log-linear buckets: values below 16 are counted
+     *  exactly, and every power of two above is split into 16
+     *  buckets, so any recorded value is known to within 1/16
+     *  (about 6%). Values of 2^40 ns (about 18 minutes) or more
+     *  all fall into the last bucket.
+     *
+     *  This is a plain value: snapshots of the live counters are
+     *  returned as histograms and can be merged freely.
+     ***********************************************************/
+    class Histogram {
+    public:
+        static constexpr int sub_bits = 4;
+        static constexpr int sub_buckets = 1 << sub_bits;
+        static constexpr int max_exponent = 40;
+        static constexpr int bucket_count = (max_exponent - sub_bits + 1) * sub_buckets;
+
+    private:
+        std::vector<std::uint64_t> my_counts;
+        std::uint64_t my_total;
+        std::uint64_t my_sum;
+
+        static int highestBit(std::uint64_t value) {
+#if defined(__GNUC__)
+            return 63 - __builtin_clzll(value);
+#else
+            int bit = 0;
+            while (value >>= 1) {
+                ++bit;
+            }
+            return bit;
+#endif
+        }
+
+    public:
+        Histogram() : my_counts(bucket_count, 0), my_total(0), my_sum(0) {}
+
+        /***********************************************************
+         *  Get the bucket a value is counted in.
+         ***********************************************************/
+        static int bucketOf(std::uint64_t value) {
+            if (value < static_cast<std::uint64_t>(sub_buckets)) {
+                return static_cast<int>(value);
+            }
+            int exponent = highestBit(value);
+            if (exponent >= max_exponent) {
+                return bucket_count - 1;
+            }
+            int sub = static_cast<int>((value >> (exponent - sub_bits)) & (sub_buckets - 1));
+            return (exponent - sub_bits + 1) * sub_buckets + sub;
+        }
+
+        /***********************************************************
+         *  Get the largest value counted in the given bucket.
+         ***********************************************************/
+        static std::uint64_t bucketUpperBound(int bucket) {
+            if (bucket < sub_buckets) {
+                return static_cast<std::uint64_t>(bucket);
+            }
+            int shift = bucket / sub_buckets - 1;
+            std::uint64_t lower = static_cast<std::uint64_t>(sub_buckets + bucket % sub_buckets) << shift;
+            return lower + (std::uint64_t(1) << shift) - 1;
+        }
+
+        // Count a value.
+        void record(std::uint64_t value) {
+            ++my_counts[bucketOf(value)];
+            ++my_total;
+            my_sum += value;
+        }
+
+        // Add the counts of a bucket, used when taking snapshots.
+        void addToBucket(int bucket, std::uint64_t count) {
+            my_counts[bucket] += count;
+            my_total += count;
+        }
+
+        // Add to the sum of all values, used when taking snapshots.
+        void addToSum(std::uint64_t sum) {
+            my_sum += sum;
+        }
+
+        // Add all values counted by another histogram.
+        void merge(const Histogram& other) {
+            for (int i = 0; i < bucket_count; ++i) {
+                my_counts[i] += other.my_counts[i];
+            }
+            my_total += other.my_total;
+            my_sum += other.my_sum;
+        }
+
+        // Get the number of values.
+        std::uint64_t getCount() const {
+            return my_total;
+        }
+
+        // Get the sum of all values.
+        std::uint64_t getSum() const {
+            return my_sum;
+        }
+
+        // Get the mean of all values, or 0 without values.
+        double getMean() const {
+            return my_total == 0 ? 0.0 : static_cast<double>(my_sum) / my_total;
+        }
+
+        /***********************************************************
+         *  Get the value below or at which "percent" percent of the
+         *  values are (rounded up to the end of its bucket), or 0
+         *  without values. getPercentile(100) is the maximum.
+         ***********************************************************/
+        std::uint64_t getPercentile(double percent) const {
+            if (my_total == 0) {
+                return 0;
+            }
+            std::uint64_t rank = static_cast<std::uint64_t>(percent / 100.0 * my_total + 0.5);
+            rank = rank < 1 ? 1 : (rank > my_total ? my_total : rank);
+            std::uint64_t seen = 0;
+            for (int i = 0; i < bucket_count; ++i) {
+                seen += my_counts[i];
+                if (seen >= rank) {
+                    return bucketUpperBound(i);
+                }
+            }
+            return bucketUpperBound(bucket_count - 1);
+        }
+
+        // Get the count of every bucket, for exporting.
+        const std::vector<std::uint64_t>& getBuckets() const {
+            return my_counts;
+        }
+    };
+
+    /***********************************************************
+     *  The live counterpart of Histogram. Recording is three
+     *  relaxed atomic additions, so a histogram owned by one
+     *  thread costs no contention, and it can still be read at
+     *  any time by snapshot().
+     ***********************************************************/
+    class ConcurrentHistogram {
+    private:
+        std::unique_ptr<std::atomic<std::uint64_t>[]> my_counts;
+        std::atomic<std::uint64_t> my_sum;
+
+    public:
+        ConcurrentHistogram()
+        : my_counts(new std::atomic<std::uint64_t>[Histogram::bucket_count]), my_sum(0) {
+            reset();
+        }
+
+        // No copy
+        ConcurrentHistogram(const ConcurrentHistogram&) = delete;
+
+        // No assignment
+        ConcurrentHistogram& operator=(const ConcurrentHistogram&) = delete;
+
+        // Count a value.
+        void record(std::uint64_t value) {
+            my_counts[Histogram::bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+            my_sum.fetch_add(value, std::memory_order_relaxed);
+        }
+
+        // Add the values counted so far to "out".
+        void snapshot(Histogram& out) const {
+            for (int i = 0; i < Histogram::bucket_count; ++i) {
+                std::uint64_t count = my_counts[i].load(std::memory_order_relaxed);
+                if (count != 0) {
+                    out.addToBucket(i, count);
+                }
+            }
+            out.addToSum(my_sum.load(std::memory_order_relaxed));
+        }
+
+        // Forget all values.
+        void reset() {
+            for (int i = 0; i < Histogram::bucket_count; ++i) {
+                my_counts[i].store(0, std::memory_order_relaxed);
+            }
+            my_sum.store(0, std::memory_order_relaxed);
+        }
+    };
+
+    /***********************************************************
+     *  What a SyncQueue or RingQueue did since its metrics were
+     *  enabled. The histograms hold how long putters waited
+     *  because the queue was full and takers waited because it
+     *  was empty, counting only operations that had to wait.
+     ***********************************************************/
+    struct QueueMetrics {
+        std::uint64_t puts = 0;
+        std::uint64_t takes = 0;
+        Histogram blocked_on_full;
+        Histogram blocked_on_empty;
+
+        void merge(const QueueMetrics& other) {
+            puts += other.puts;
+            takes += other.takes;
+            blocked_on_full.merge(other.blocked_on_full);
+            blocked_on_empty.merge(other.blocked_on_empty);
+        }
+    };
+
+    /***********************************************************
+     *  What a worker of a ThreadPool did since the metrics were
+     *  enabled. Idle time is time spent sleeping for work.
+     ***********************************************************/
+    struct WorkerMetrics {
+        std::uint64_t tasks_run = 0;
+        std::uint64_t tasks_stolen = 0;
+        std::uint64_t busy_ns = 0;
+        std::uint64_t idle_ns = 0;
+    };
+
+    /***********************************************************
+     *  A snapshot of a ThreadPool's metrics. "queue_depth" is the
+     *  number of tasks waiting when the snapshot was taken. The
+     *  totals include tasks run by threads helping the pool (see
+     *  ThreadPool::runPendingTask). "queue_wait" is the time from
+     *  submitting a task to starting it, "execution" the time it
+     *  ran, and "queue" the metrics of the pool's task queues.
+     ***********************************************************/
+    struct ThreadPoolMetrics {
+        std::vector<WorkerMetrics> workers;
+        std::uint64_t tasks_run = 0;
+        std::uint64_t tasks_stolen = 0;
+        int queue_depth = 0;
+        Histogram queue_wait;
+        Histogram execution;
+        QueueMetrics queue;
+    };
+}
+
+#endif
@@ -0,0 +1,360 @@
+#ifndef _PARALLEL_HPP_
+#define _PARALLEL_HPP_
+
+#include "ThreadPool.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <future>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+
+namespace acht {
+
+    /***********************************************************
+     *  A group of tasks submitted to a thread pool that can be
+     *  waited for as a whole.
+     *
+     *  The thread calling wait() runs queued tasks of the pool
+     *  while the group is not finished, so it never sits idle,
+     *  and waiting from inside a worker cannot starve the pool.
+     *  The first exception thrown by a task is rethrown by wait().
+     *  A task that the pool drops because it was shut down counts
+     *  as failed with a broken_promise future_error.
+     ***********************************************************/
+    class TaskGroup {
+    private:
+        struct State {
+            std::atomic<int> pending{0};
+            std::mutex my_mutex;
+            std::condition_variable done;
+            std::exception_ptr error;
+        };
+
+        ThreadPool& my_pool;
+        std::shared_ptr<State> my_state;
+
+        /***********************************************************
+         *  Mark one task as finished.
+         ***********************************************************/
+        static void finish(State& state) {
+            if (state.pending.fetch_sub(1) == 1) {
+                std::lock_guard<std::mutex> lock(state.my_mutex);
+                state.done.notify_all();
+            }
+        }
+
+        /***********************************************************
+         *  Keep the first error of the group.
+         ***********************************************************/
+        static void fail(State& state, std::exception_ptr error) {
+            std::lock_guard<std::mutex> lock(state.my_mutex);
+            if (!state.error) {
+                state.error = error;
+            }
+        }
+
+        /***********************************************************
+         *  One pending task of the group, carried by the task. If
+         *  the pool drops the task without running it (it was shut
+         *  down), the task is finished when it is destroyed, with a
+         *  broken_promise error as for the future of such a task.
+         ***********************************************************/
+        class Ticket {
+        private:
+            std::shared_ptr<State> my_state;
+
+        public:
+            explicit Ticket(std::shared_ptr<State> state) : my_state(std::move(state)) {
+                my_state->pending.fetch_add(1);
+            }
+
+            Ticket(Ticket&& other) noexcept : my_state(std::move(other.my_state)) {}
+
+            ~Ticket() {
+                if (my_state) {
+                    fail(*my_state, std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+                    finish(*my_state);
+                }
+            }
+
+            // No copy
+            Ticket(const Ticket&) = delete;
+
+            // No assignment
+            Ticket& operator=(const Ticket&) = delete;
+            Ticket& operator=(Ticket&&) = delete;
+
+            // Mark the task as finished, once it ran.
+            void done(std::exception_ptr error) {
+                if (error) {
+                    fail(*my_state, error);
+                }
+                finish(*my_state);
+                my_state = nullptr;
+            }
+        };
+
+    public:
+        explicit TaskGroup(ThreadPool& pool) : my_pool(pool), my_state(std::make_shared<State>()) {}
+
+        /***********************************************************
+         *  Wait for the remaining tasks. Exceptions are dropped
+         *  here, call wait() to see them.
+         ***********************************************************/
+        ~TaskGroup() {
+            try {
+                wait();
+            }
+            catch (...) {}
+        }
+
+        // No copy
+        TaskGroup(const TaskGroup&) = delete;
+
+        // No assignment
+        TaskGroup& operator=(const TaskGroup&) = delete;
+
+        /***********************************************************
+         *  Submit a task as part of this group.
+         ***********************************************************/
+        template <typename F>
+        void run(F&& func) {
+            my_pool.submit(UniqueTask([ticket = Ticket(my_state), func = std::forward<F>(func)]() mutable {
+                std::exception_ptr error;
+                try {
+                    func();
+                }
+                catch (...) {
+                    error = std::current_exception();
+                }
+                ticket.done(error);
+            }));
+        }
+
+        /***********************************************************
+         *  Block until every task of the group has finished,
+         *  running queued tasks of the pool in the meantime.
+         ***********************************************************/
+        void wait() {
+            while (my_state->pending.load() > 0) {
+                if (my_pool.runPendingTask()) {
+                    continue;
+                }
+                // Nothing to help with right now. Sleep briefly, since
+                // our tasks may still spawn work we could run.
+                std::unique_lock<std::mutex> lock(my_state->my_mutex);
+                my_state->done.wait_for(lock, std::chrono::microseconds(100), [this] {
+                    return my_state->pending.load() == 0;
+                });
+            }
+            std::lock_guard<std::mutex> lock(my_state->my_mutex);
+            if (my_state->error) {
+                std::exception_ptr error = my_state->error;
+                my_state->error = nullptr;
+                std::rethrow_exception(error);
+            }
+        }
+    };
+
+    namespace detail {
+
+        /***********************************************************
+         *  The shared state of a loop over [begin, end) split into
+         *  chunks. Threads claim chunks with guided self-scheduling:
+         *  a chunk is a share of what remains divided between the
+         *  participants, but never less than "grain". So chunks are
+         *  large at first (little per-task overhead) and get smaller
+         *  towards the end (good load balance).
+         ***********************************************************/
+        template <typename Index, typename Body>
+        struct ChunkedLoop {
+            std::atomic<Index> next;
+            Index end;
+            Index grain;
+            Index participants;
+            Body* body;
+            std::atomic<Index> remaining;
+            std::mutex my_mutex;
+            std::condition_variable done;
+            std::exception_ptr error;
+
+            ChunkedLoop(Index first, Index last, Index min_chunk, Index threads, Body* loop_body)
+            : next(first), end(last), grain(min_chunk), participants(threads), body(loop_body),
+              remaining(last - first) {}
+
+            // Claim the next chunk. Return false if nothing is left.
+            bool claim(Index& lo, Index& hi) {
+                Index cur = next.load(std::memory_order_relaxed);
+                while (cur < end) {
+                    Index size = std::max(grain, static_cast<Index>((end - cur) / (2 * participants)));
+                    Index stop = end - cur > size ? cur + size : end;
+                    if (next.compare_exchange_weak(cur, stop, std::memory_order_relaxed)) {
+                        lo = cur;
+                        hi = stop;
+                        return true;
+                    }
+                }
+                return false;
+            }
+
+            // Mark "count" indexes as processed.
+            void finish(Index count) {
+                if (remaining.fetch_sub(count) == count) {
+                    std::lock_guard<std::mutex> lock(my_mutex);
+                    done.notify_all();
+                }
+            }
+
+            // Process chunks until none is left.
+            void work() {
+                Index lo, hi;
+                while (claim(lo, hi)) {
+                    try {
+                        (*body)(lo, hi);
+                    }
+                    catch (...) {
+                        {
+                            std::lock_guard<std::mutex> lock(my_mutex);
+                            if (!error) {
+                                error = std::current_exception();
+                            }
+                        }
+                        // Skip everything nobody has claimed yet.
+                        Index rest = next.exchange(end);
+                        if (rest < end) {
+                            finish(end - rest);
+                        }
+                    }
+                    finish(hi - lo);
+                }
+            }
+        };
+
+        /***********************************************************
+         *  Run "body(lo, hi)" over chunks of [begin, end) on the
+         *  pool and the calling thread, and return when all chunks
+         *  are done. Helper tasks that start late find nothing to
+         *  claim and return without touching "body".
+         ***********************************************************/
+        template <typename Index, typename Body>
+        void runChunked(ThreadPool& pool, Index begin, Index end, Index grain, Body& body) {
+            static_assert(std::is_integral<Index>::value, "Index must be an integral type");
+            if (!(begin < end)) {
+                return;
+            }
+            if (grain < 1) {
+                grain = 1;
+            }
+            Index threads = static_cast<Index>(pool.getThreadCount());
+            Index chunks = (end - begin + grain - 1) / grain;
+            if (threads < 1 || chunks < 2) {
+                body(begin, end);
+                return;
+            }
+
+            using Loop = ChunkedLoop<Index, Body>;
+            std::shared_ptr<Loop> loop = std::make_shared<Loop>(begin, end, grain, threads + 1, &body);
+            Index helpers = std::min(threads, chunks - 1);
+            for (Index i = 0; i < helpers; ++i) {
+                // If the pool is saturated, the caller does the work.
+                if (!pool.trySubmit(UniqueTask([loop] { loop->work(); }))) {
+                    break;
+                }
+            }
+
+            loop->work();
+            std::unique_lock<std::mutex> lock(loop->my_mutex);
+            loop->done.wait(lock, [&loop] { return loop->remaining.load() == 0; });
+            if (loop->error) {
+                std::rethrow_exception(loop->error);
+            }
+        }
+    }
+
+    /***********************************************************
+     *  Call "func(i)" for every i in [begin, end) on the pool,
+     *  and return when all calls are done. The calling thread
+     *  takes part in the work. "grain" is the smallest number of
+     *  indexes handed out at once; pass 0 to let it be chosen
+     *  automatically. The first exception thrown is rethrown.
+     ***********************************************************/
+    template <typename Index, typename Function>
+    void parallelFor(ThreadPool& pool, Index begin, Index end, Index grain, Function&& func) {
+        auto body = [&func](Index lo, Index hi) {
+            for (Index i = lo; i < hi; ++i) {
+                func(i);
+            }
+        };
+        detail::runChunked(pool, begin, end, grain, body);
+    }
+
+    /***********************************************************
+     *  Compute reduce(... reduce(identity, map(begin)) ..., map(end - 1))
+     *  on the pool. Every chunk is reduced on its own and the
+     *  partial results are combined in no particular order, so
+     *  "reduce" must be associative and commutative, and
+     *  "identity" must be its neutral element.
+     ***********************************************************/
+    template <typename Index, typename T, typename Map, typename Reduce>
+    T parallelReduce(ThreadPool& pool, Index begin, Index end, Index grain,
+                     T identity, Map&& map, Reduce&& reduce) {
+        T total = identity;
+        std::mutex total_mutex;
+        auto body = [&](Index lo, Index hi) {
+            T partial = identity;
+            for (Index i = lo; i < hi; ++i) {
+                partial = reduce(std::move(partial), map(i));
+            }
+            std::lock_guard<std::mutex> lock(total_mutex);
+            total = reduce(std::move(total), std::move(partial));
+        };
+        detail::runChunked(pool, begin, end, grain, body);
+        return total;
+    }
+
+    /***********************************************************
+     *  Sort [first, last) on the pool. The range is split into
+     *  one block per participant, blocks are sorted in parallel
+     *  and then merged pairwise, also in parallel. Like std::sort
+     *  the sort is not stable.
+     ***********************************************************/
+    template <typename RandomIt, typename Compare = std::less<>>
+    void parallelSort(ThreadPool& pool, RandomIt first, RandomIt last, Compare comp = Compare()) {
+        using Diff = typename std::iterator_traits<RandomIt>::difference_type;
+        const Diff min_block = 4096;
+        Diff size = last - first;
+        Diff blocks = std::min<Diff>(pool.getThreadCount() + 1, size / min_block);
+        if (blocks < 2) {
+            std::sort(first, last, comp);
+            return;
+        }
+
+        // Block i covers [bound(i), bound(i + 1)).
+        auto bound = [&](Diff i) {
+            return first + size * i / blocks;
+        };
+        parallelFor(pool, Diff(0), blocks, Diff(1), [&](Diff i) {
+            std::sort(bound(i), bound(i + 1), comp);
+        });
+        for (Diff width = 1; width < blocks; width *= 2) {
+            Diff pairs = (blocks + 2 * width - 1) / (2 * width);
+            parallelFor(pool, Diff(0), pairs, Diff(1), [&](Diff p) {
+                Diff lo = p * 2 * width;
+                Diff mid = std::min(lo + width, blocks);
+                Diff hi = std::min(lo + 2 * width, blocks);
+                if (mid < hi) {
+                    std::inplace_merge(bound(lo), bound(mid), bound(hi), comp);
+                }
+            });
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,947 @@
+#ifndef _RING_QUEUE_HPP_
+#define _RING_QUEUE_HPP_
+
+#include <queue>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <new>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include <algorithm>
+#include <chrono>
+#include "WaitStrategy.hpp"
+#include "Metrics.hpp"
+
+namespace acht {
+
+    /***********************************************************
+     *  A lock-free bounded multi-producer/multi-consumer queue
+     *  with the interface of SyncQueue: put, take and their
+     *  timed and batch forms, takeAll, start and stop, priority
+     *  lanes and metrics. All slots are preallocated and each
+     *  slot lives on its own cache line. Threads only park on a
+     *  condition variable when the queue is really full (put)
+     *  or empty (take).
+     *
+     *  Where it differs from SyncQueue:
+     *  - The capacity is rounded up to a power of two and
+     *    allocated at construction. setMaxSize() can lower the
+     *    limit, but not raise it above that capacity.
+     *  - Every lane is a ring of its own with that capacity, so
+     *    a full lane only holds up its own producers.
+     *  - Lanes are only ever added (see setLanes), and takers
+     *    share them by weight in rounds rather than smoothly.
+     ***********************************************************/
+    template <typename T>
+    class RingQueue {
+    private:
+        static constexpr std::size_t cache_line_size = 64;
+        // The most lanes a queue can have.
+        static constexpr int max_lanes = 8;
+
+        struct alignas(cache_line_size) Slot {
+            std::atomic<std::size_t> sequence;
+            typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+
+            T* elem() {
+                return reinterpret_cast<T*>(&storage);
+            }
+        };
+
+        /***********************************************************
+         *  A ring of slots: the elements of one lane. Its slots
+         *  are allocated when the lane is first used.
+         ***********************************************************/
+        struct Lane {
+            std::unique_ptr<Slot[]> slots;
+            std::size_t mask = 0;
+
+            // Producers and consumers spin on different cache lines.
+            alignas(cache_line_size) std::atomic<std::size_t> enqueue_pos{0};
+            alignas(cache_line_size) std::atomic<std::size_t> dequeue_pos{0};
+
+            alignas(cache_line_size) std::atomic<int> weight{1};
+            std::atomic<int> waiting_putters{0};
+            std::condition_variable not_full;
+
+            void allocate(std::size_t capacity) {
+                slots.reset(new Slot[capacity]);
+                mask = capacity - 1;
+                for (std::size_t i = 0; i < capacity; ++i) {
+                    slots[i].sequence.store(i, std::memory_order_relaxed);
+                }
+            }
+
+            /***********************************************************
+             *  Try to add the element without waiting. Return false
+             *  if the ring is full, or holds "limit" elements already.
+             ***********************************************************/
+            template <typename Type>
+            bool tryPut(Type&& elem, std::size_t limit) {
+                std::size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+                while (true) {
+                    if (limit <= mask && pos - dequeue_pos.load() >= limit) {
+                        return false;
+                    }
+                    Slot& slot = slots[pos & mask];
+                    std::size_t seq = slot.sequence.load(std::memory_order_acquire);
+                    std::intptr_t diff = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos);
+                    if (diff == 0) {
+                        if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                            new (slot.elem()) T(std::forward<Type>(elem));
+                            slot.sequence.store(pos + 1);
+                            return true;
+                        }
+                    }
+                    else if (diff < 0) {
+                        // The slot still holds an element from the last lap.
+                        return false;
+                    }
+                    else {
+                        pos = enqueue_pos.load(std::memory_order_relaxed);
+                    }
+                }
+            }
+
+            /***********************************************************
+             *  Try to move the head element into "consume" without
+             *  waiting. Return false if the ring is empty.
+             ***********************************************************/
+            template <typename Consume>
+            bool tryTake(Consume& consume) {
+                std::size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+                while (true) {
+                    Slot& slot = slots[pos & mask];
+                    std::size_t seq = slot.sequence.load(std::memory_order_acquire);
+                    std::intptr_t diff = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos + 1);
+                    if (diff == 0) {
+                        if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                            consume(std::move(*slot.elem()));
+                            slot.elem()->~T();
+                            slot.sequence.store(pos + mask + 1);
+                            return true;
+                        }
+                    }
+                    else if (diff < 0) {
+                        // No producer has filled this slot yet.
+                        return false;
+                    }
+                    else {
+                        pos = dequeue_pos.load(std::memory_order_relaxed);
+                    }
+                }
+            }
+
+            // Check if a put would fail.
+            bool full(std::size_t limit) const {
+                std::size_t pos = enqueue_pos.load();
+                if (limit <= mask && pos - dequeue_pos.load() >= limit) {
+                    return true;
+                }
+                std::size_t seq = slots[pos & mask].sequence.load();
+                return static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos) < 0;
+            }
+
+            // Check if the slot at the head is not filled yet.
+            bool empty() const {
+                std::size_t pos = dequeue_pos.load();
+                std::size_t seq = slots[pos & mask].sequence.load();
+                return static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos + 1) < 0;
+            }
+
+            // Get the (approximate) number of elements.
+            int size() const {
+                std::size_t head = dequeue_pos.load();
+                std::size_t tail = enqueue_pos.load();
+                return tail > head ? static_cast<int>(tail - head) : 0;
+            }
+        };
+
+        // What the metrics count into, shared by all threads.
+        struct Recording {
+            std::atomic<std::uint64_t> puts{0};
+            std::atomic<std::uint64_t> takes{0};
+            ConcurrentHistogram blocked_on_full;
+            ConcurrentHistogram blocked_on_empty;
+
+            void reset() {
+                puts = 0;
+                takes = 0;
+                blocked_on_full.reset();
+                blocked_on_empty.reset();
+            }
+        };
+
+        std::unique_ptr<Lane[]> my_lanes;
+        std::size_t my_capacity;
+        std::atomic<int> lane_count;
+        std::atomic<std::size_t> size_limit;
+
+        // Counts takes, to share them between lanes by weight.
+        alignas(cache_line_size) std::atomic<unsigned> take_turn;
+
+        alignas(cache_line_size) std::atomic<bool> need_to_stop;
+        std::atomic<int> waiting_takers;
+        std::mutex park_mutex;
+        std::condition_variable not_empty;
+        std::atomic<WaitStrategy> wait_strategy;
+
+        // Allocated when metrics are first enabled, and kept when
+        // they are disabled. Operations count into "recording",
+        // which is null while metrics are disabled.
+        std::unique_ptr<Recording> my_metrics;
+        std::atomic<Recording*> recording;
+
+        /***********************************************************
+         *  Round the given size up to a power of two (at least 2),
+         *  so that a slot index is a simple mask of the position.
+         ***********************************************************/
+        static std::size_t roundUpCapacity(int maxSize) {
+            std::size_t capacity = 2;
+            while (capacity < static_cast<std::size_t>(maxSize)) {
+                capacity <<= 1;
+            }
+            return capacity;
+        }
+
+        /***********************************************************
+         *  Get the given lane (the last lane if there is no such
+         *  lane).
+         ***********************************************************/
+        Lane& laneAt(int lane) {
+            int last = lane_count.load(std::memory_order_acquire) - 1;
+            return my_lanes[lane < 0 ? 0 : (lane > last ? last : lane)];
+        }
+
+        /***********************************************************
+         *  Choose the lane to take from first: every round of takes
+         *  gives each lane as many turns as its weight.
+         ***********************************************************/
+        int firstLane(int count) {
+            int weights[max_lanes];
+            unsigned total = 0;
+            for (int i = 0; i < count; ++i) {
+                weights[i] = my_lanes[i].weight.load(std::memory_order_relaxed);
+                total += static_cast<unsigned>(weights[i]);
+            }
+            int turn = static_cast<int>(take_turn.fetch_add(1, std::memory_order_relaxed) % total);
+            for (int i = 0; i < count; ++i) {
+                if (turn < weights[i]) {
+                    return i;
+                }
+                turn -= weights[i];
+            }
+            return count - 1;
+        }
+
+        /***********************************************************
+         *  Try to add the element to the given lane without waiting.
+         *  Return false if that lane is full.
+         ***********************************************************/
+        template <typename Type>
+        bool tryPutHelper(Type&& elem, Lane& lane) {
+            if (!lane.tryPut(std::forward<Type>(elem), size_limit.load(std::memory_order_relaxed))) {
+                return false;
+            }
+            count(&Recording::puts, 1);
+            return true;
+        }
+
+        /***********************************************************
+         *  Try to move the head element of the lane whose turn it
+         *  is (or else of any lane) into "consume" without waiting.
+         *  Return the lane taken from, or nullptr if the queue is
+         *  empty.
+         ***********************************************************/
+        template <typename Consume>
+        Lane* tryTakeHelper(Consume& consume) {
+            int count_of_lanes = lane_count.load(std::memory_order_acquire);
+            if (count_of_lanes == 1) {
+                if (!my_lanes[0].tryTake(consume)) {
+                    return nullptr;
+                }
+                count(&Recording::takes, 1);
+                return &my_lanes[0];
+            }
+            int first = firstLane(count_of_lanes);
+            for (int i = 0; i < count_of_lanes; ++i) {
+                Lane& lane = my_lanes[(first + i) % count_of_lanes];
+                if (lane.tryTake(consume)) {
+                    count(&Recording::takes, 1);
+                    return &lane;
+                }
+            }
+            return nullptr;
+        }
+
+        /***********************************************************
+         *  Take the head element into "elem" without waiting, and
+         *  wake up a producer of its lane.
+         ***********************************************************/
+        bool tryTakeInto(T& elem) {
+            auto assign = [&elem](T&& taken) {
+                elem = std::move(taken);
+            };
+            Lane* lane = tryTakeHelper(assign);
+            if (lane == nullptr) {
+                return false;
+            }
+            wakeOne(lane->waiting_putters, lane->not_full);
+            return true;
+        }
+
+        /***********************************************************
+         *  Take up to "maxN" elements into "out" without waiting,
+         *  and wake up as many producers of their lanes.
+         ***********************************************************/
+        void tryTakeMany(std::vector<T>& out, int maxN) {
+            int taken[max_lanes] = {};
+            auto append = [&out](T&& elem) {
+                out.emplace_back(std::move(elem));
+            };
+            while (static_cast<int>(out.size()) < maxN) {
+                Lane* lane = tryTakeHelper(append);
+                if (lane == nullptr) {
+                    break;
+                }
+                ++taken[lane - my_lanes.get()];
+            }
+            wakeLanes(taken);
+        }
+
+        // Wake up producers of every lane as many elements were taken from.
+        void wakeLanes(const int (&taken)[max_lanes]) {
+            for (int i = 0; i < max_lanes; ++i) {
+                if (taken[i] > 0) {
+                    wakeMany(my_lanes[i].waiting_putters, my_lanes[i].not_full, taken[i]);
+                }
+            }
+        }
+
+        // Add "n" to a counter of the metrics, if they are enabled.
+        void count(std::atomic<std::uint64_t> Recording::*counter, std::uint64_t n) {
+            Recording* metrics = recording.load(std::memory_order_relaxed);
+            if (metrics && n > 0) {
+                (metrics->*counter).fetch_add(n, std::memory_order_relaxed);
+            }
+        }
+
+        /***********************************************************
+         *  Get the time a wait started if metrics are enabled, and
+         *  record how long it took once it is over.
+         ***********************************************************/
+        std::chrono::steady_clock::time_point waitStarted() const {
+            return recording.load(std::memory_order_relaxed) ? std::chrono::steady_clock::now()
+                                                             : std::chrono::steady_clock::time_point();
+        }
+
+        void waitEnded(std::chrono::steady_clock::time_point since, bool putting) {
+            Recording* metrics = recording.load(std::memory_order_relaxed);
+            if (since == std::chrono::steady_clock::time_point() || !metrics) {
+                return;
+            }
+            auto waited = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - since);
+            ConcurrentHistogram& blocked = putting ? metrics->blocked_on_full : metrics->blocked_on_empty;
+            blocked.record(static_cast<std::uint64_t>(waited.count()));
+        }
+
+        /***********************************************************
+         *  Check if no lane has an element.
+         ***********************************************************/
+        bool empty() const {
+            int count_of_lanes = lane_count.load(std::memory_order_acquire);
+            for (int i = 0; i < count_of_lanes; ++i) {
+                if (!my_lanes[i].empty()) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        bool full(const Lane& lane) const {
+            return lane.full(size_limit.load(std::memory_order_relaxed));
+        }
+
+        /***********************************************************
+         *  Wake up one parked thread if there is any. Slot sequences
+         *  and waiter counts are all sequentially consistent, so
+         *  either the waiter sees the new state or we see the waiter.
+         ***********************************************************/
+        void wakeOne(std::atomic<int>& waiting, std::condition_variable& cond) {
+            if (waiting.load() > 0) {
+                std::lock_guard<std::mutex> lock(park_mutex);
+                cond.notify_one();
+            }
+        }
+
+        /***********************************************************
+         *  Wake up "count" parked threads, or all of them if there
+         *  are fewer waiters than that.
+         ***********************************************************/
+        void wakeMany(std::atomic<int>& waiting, std::condition_variable& cond, int count) {
+            int waiters = waiting.load();
+            if (waiters > 0 && count > 0) {
+                std::lock_guard<std::mutex> lock(park_mutex);
+                if (count >= waiters) {
+                    cond.notify_all();
+                }
+                else {
+                    for (int i = 0; i < count; ++i) {
+                        cond.notify_one();
+                    }
+                }
+            }
+        }
+
+        /***********************************************************
+         *  Park the calling thread until "ready" returns true or
+         *  the queue is stopped.
+         ***********************************************************/
+        template <typename Predicate>
+        void park(std::atomic<int>& waiting, std::condition_variable& cond, Predicate ready) {
+            std::unique_lock<std::mutex> lock(park_mutex);
+            waiting.fetch_add(1);
+            while (!need_to_stop && !ready()) {
+                cond.wait(lock);
+            }
+            waiting.fetch_sub(1);
+        }
+
+        /***********************************************************
+         *  The same as park, but give up at the deadline. Return
+         *  false if the deadline passed.
+         ***********************************************************/
+        template <typename Predicate, typename Clock, typename Duration>
+        bool parkUntil(std::atomic<int>& waiting, std::condition_variable& cond, Predicate ready,
+                       const std::chrono::time_point<Clock, Duration>& deadline) {
+            if (Clock::now() >= deadline) {
+                return ready();
+            }
+            std::unique_lock<std::mutex> lock(park_mutex);
+            waiting.fetch_add(1);
+            bool in_time = true;
+            while (in_time && !need_to_stop && !ready()) {
+                in_time = cond.wait_until(lock, deadline) == std::cv_status::no_timeout;
+            }
+            waiting.fetch_sub(1);
+            return in_time || ready();
+        }
+
+        /***********************************************************
+         *  Spin according to the wait strategy until "ready" returns
+         *  true or the queue is stopped.
+         ***********************************************************/
+        template <typename Predicate>
+        void spin(Predicate ready) {
+            WaitStrategy strategy = wait_strategy.load(std::memory_order_relaxed);
+            if (strategy.spins()) {
+                strategy.spinUntil([&] {
+                    return need_to_stop.load(std::memory_order_relaxed) || ready();
+                });
+            }
+        }
+
+        /***********************************************************
+         *  A helper function that adds element to the queue,
+         *  waiting if its lane is full.
+         ***********************************************************/
+        template <typename Type>
+        void putHelper(Type&& elem, int lane_index) {
+            Lane& lane = laneAt(lane_index);
+            bool spun = false;
+            std::chrono::steady_clock::time_point since;
+            while (!need_to_stop) {
+                if (tryPutHelper(std::forward<Type>(elem), lane)) {
+                    wakeOne(waiting_takers, not_empty);
+                    break;
+                }
+                if (!spun) {
+                    since = waitStarted();
+                    spin([&] { return !full(lane); });
+                    spun = true;
+                    continue;
+                }
+                park(lane.waiting_putters, lane.not_full, [&] { return !full(lane); });
+            }
+            waitEnded(since, true);
+        }
+
+        /***********************************************************
+         *  A helper function that adds element to the queue,
+         *  waiting until the deadline if its lane is full.
+         ***********************************************************/
+        template <typename Type, typename Clock, typename Duration>
+        bool tryPutUntilHelper(Type&& elem, const std::chrono::time_point<Clock, Duration>& deadline, int lane_index) {
+            Lane& lane = laneAt(lane_index);
+            bool spun = false;
+            bool added = false;
+            std::chrono::steady_clock::time_point since;
+            while (!need_to_stop) {
+                if (tryPutHelper(std::forward<Type>(elem), lane)) {
+                    wakeOne(waiting_takers, not_empty);
+                    added = true;
+                    break;
+                }
+                if (!spun) {
+                    since = waitStarted();
+                    spin(untilDeadline([&] { return !full(lane); }, deadline));
+                    spun = true;
+                    continue;
+                }
+                if (!parkUntil(lane.waiting_putters, lane.not_full, [&] { return !full(lane); }, deadline)) {
+                    break;
+                }
+            }
+            waitEnded(since, true);
+            return added;
+        }
+
+    public:
+        /***********************************************************
+         *  The capacity is rounded up to a power of two, and all
+         *  slots of the first lane are allocated here.
+         ***********************************************************/
+        RingQueue(int maxSize, WaitStrategy strategy = WaitStrategy())
+        : my_lanes(new Lane[max_lanes]), my_capacity(roundUpCapacity(maxSize)), lane_count(1),
+          size_limit(my_capacity), take_turn(0), need_to_stop(false), waiting_takers(0),
+          wait_strategy(strategy), recording(nullptr) {
+            my_lanes[0].allocate(my_capacity);
+        }
+
+        ~RingQueue() {
+            // If the queue wasn't stoped, then stop it.
+            stop();
+            clear();
+        }
+
+        // No copy
+        RingQueue(const RingQueue&) = delete;
+
+        // No assignment
+        RingQueue& operator=(const RingQueue&) = delete;
+
+        /***********************************************************
+         *  Add the given element to this queue (to the given lane),
+         *  waiting if the lane is full.
+         ***********************************************************/
+        void put(const T& elem, int lane = 0) {
+            putHelper(elem, lane);
+        }
+
+        void put(T&& elem, int lane = 0) {
+            putHelper(std::move(elem), lane);
+        }
+
+        /***********************************************************
+         *  Retrieve and remove the head of this queue.
+         *
+         *  There are two modes for this operation: Blocked or not.
+         *  If "blocking" is true, then wait if the queue is empty.
+         *  If "blocking" is false, then give up if the queue is empty.
+         ***********************************************************/
+        bool take(T& elem, bool blocking = true) {
+            bool spun = false;
+            bool taken = false;
+            std::chrono::steady_clock::time_point since;
+            while (!need_to_stop) {
+                if (tryTakeInto(elem)) {
+                    taken = true;
+                    break;
+                }
+                if (!blocking) {
+                    break;
+                }
+                if (!spun) {
+                    since = waitStarted();
+                    spin([this] { return !empty(); });
+                    spun = true;
+                    continue;
+                }
+                park(waiting_takers, not_empty, [this] { return !empty(); });
+            }
+            waitEnded(since, false);
+            return taken;
+        }
+
+        /***********************************************************
+         *  Add the given element to this queue, waiting at most
+         *  "timeout" if its lane is full. Return false if the
+         *  element was not added.
+         ***********************************************************/
+        template <typename Rep, typename Period>
+        bool tryPutFor(const T& elem, const std::chrono::duration<Rep, Period>& timeout, int lane = 0) {
+            return tryPutUntilHelper(elem, std::chrono::steady_clock::now() + timeout, lane);
+        }
+
+        template <typename Rep, typename Period>
+        bool tryPutFor(T&& elem, const std::chrono::duration<Rep, Period>& timeout, int lane = 0) {
+            return tryPutUntilHelper(std::move(elem), std::chrono::steady_clock::now() + timeout, lane);
+        }
+
+        /***********************************************************
+         *  Add the given element to this queue, waiting until
+         *  "deadline" if its lane is full. Return false if the
+         *  element was not added.
+         ***********************************************************/
+        template <typename Clock, typename Duration>
+        bool tryPutUntil(const T& elem, const std::chrono::time_point<Clock, Duration>& deadline, int lane = 0) {
+            return tryPutUntilHelper(elem, deadline, lane);
+        }
+
+        template <typename Clock, typename Duration>
+        bool tryPutUntil(T&& elem, const std::chrono::time_point<Clock, Duration>& deadline, int lane = 0) {
+            return tryPutUntilHelper(std::move(elem), deadline, lane);
+        }
+
+        /***********************************************************
+         *  Retrieve and remove the head of this queue, waiting at
+         *  most "timeout" if the queue is empty. Return false if
+         *  nothing was taken.
+         ***********************************************************/
+        template <typename Rep, typename Period>
+        bool tryTakeFor(T& elem, const std::chrono::duration<Rep, Period>& timeout) {
+            return tryTakeUntil(elem, std::chrono::steady_clock::now() + timeout);
+        }
+
+        /***********************************************************
+         *  Retrieve and remove the head of this queue, waiting until
+         *  "deadline" if the queue is empty. Return false if nothing
+         *  was taken.
+         ***********************************************************/
+        template <typename Clock, typename Duration>
+        bool tryTakeUntil(T& elem, const std::chrono::time_point<Clock, Duration>& deadline) {
+            bool spun = false;
+            bool taken = false;
+            std::chrono::steady_clock::time_point since;
+            while (!need_to_stop) {
+                if (tryTakeInto(elem)) {
+                    taken = true;
+                    break;
+                }
+                if (!spun) {
+                    since = waitStarted();
+                    spin(untilDeadline([this] { return !empty(); }, deadline));
+                    spun = true;
+                    continue;
+                }
+                if (!parkUntil(waiting_takers, not_empty, [this] { return !empty(); }, deadline)) {
+                    break;
+                }
+            }
+            waitEnded(since, false);
+            return taken;
+        }
+
+        /***********************************************************
+         *  Retrieve and remove all elements of this queue. With
+         *  several lanes they are moved out in the order they would
+         *  have been taken one by one.
+         *
+         *  There are two modes for this operation: Blocked or not.
+         *  If "blocking" is true, then wait if the queue is empty.
+         *  If "blocking" is false, then give up if the queue is empty.
+         ***********************************************************/
+        template <typename Container>
+        bool takeAll(std::queue<T, Container> &other_queue, bool blocking = true) {
+            std::vector<T> first;
+            if (!takeBatch(first, 1, blocking)) {
+                return false;
+            }
+            other_queue = std::queue<T, Container>();
+            other_queue.emplace(std::move(first.front()));
+            int taken[max_lanes] = {};
+            auto append = [&other_queue](T&& elem) {
+                other_queue.emplace(std::move(elem));
+            };
+            while (Lane* lane = tryTakeHelper(append)) {
+                ++taken[lane - my_lanes.get()];
+            }
+            wakeLanes(taken);
+            return true;
+        }
+
+        /***********************************************************
+         *  Add the elements in [first, last) to this queue, waiting
+         *  whenever the lane is full. Consumers are woken once for
+         *  each run of elements added without parking. Pass move
+         *  iterators to move the elements in.
+         *
+         *  Return the number of elements added, which is less than
+         *  the length of the range only if the queue was stopped.
+         ***********************************************************/
+        template <typename InputIt>
+        int putBatch(InputIt first, InputIt last, int lane_index = 0) {
+            Lane& lane = laneAt(lane_index);
+            int count = 0;
+            int pending = 0;
+            while (first != last && !need_to_stop) {
+                if (tryPutHelper(*first, lane)) {
+                    ++first;
+                    ++count;
+                    ++pending;
+                    continue;
+                }
+                wakeMany(waiting_takers, not_empty, pending);
+                pending = 0;
+                std::chrono::steady_clock::time_point since = waitStarted();
+                park(lane.waiting_putters, lane.not_full, [&] { return !full(lane); });
+                waitEnded(since, true);
+            }
+            wakeMany(waiting_takers, not_empty, pending);
+            return count;
+        }
+
+        /***********************************************************
+         *  Add as many elements of [first, last) as fit into the
+         *  lane without waiting. Return the number of elements
+         *  added.
+         ***********************************************************/
+        template <typename InputIt>
+        int tryPutBatch(InputIt first, InputIt last, int lane_index = 0) {
+            Lane& lane = laneAt(lane_index);
+            int count = 0;
+            for (; first != last && !need_to_stop && tryPutHelper(*first, lane); ++first) {
+                ++count;
+            }
+            wakeMany(waiting_takers, not_empty, count);
+            return count;
+        }
+
+        /***********************************************************
+         *  Retrieve and remove up to "maxN" elements from the head
+         *  of this queue into "out". The vector is cleared first, so
+         *  the same vector can be reused across calls without
+         *  reallocating.
+         *
+         *  There are two modes for this operation: Blocked or not.
+         *  If "blocking" is true, then wait if the queue is empty.
+         *  If "blocking" is false, then give up if the queue is empty.
+         *  Nothing is taken, and false returned, if "maxN" is less
+         *  than 1.
+         ***********************************************************/
+        bool takeBatch(std::vector<T>& out, int maxN, bool blocking = true) {
+            out.clear();
+            if (maxN < 1) {
+                return false;
+            }
+            std::chrono::steady_clock::time_point since;
+            while (!need_to_stop) {
+                tryTakeMany(out, maxN);
+                if (!out.empty() || !blocking) {
+                    break;
+                }
+                if (since == std::chrono::steady_clock::time_point()) {
+                    since = waitStarted();
+                }
+                park(waiting_takers, not_empty, [this] { return !empty(); });
+            }
+            waitEnded(since, false);
+            return !out.empty();
+        }
+
+        /***********************************************************
+         *  The same as takeBatch, but wait at most "timeout" if the
+         *  queue is empty. Return false if nothing was taken.
+         ***********************************************************/
+        template <typename Rep, typename Period>
+        bool tryTakeBatchFor(std::vector<T>& out, int maxN, const std::chrono::duration<Rep, Period>& timeout) {
+            return tryTakeBatchUntil(out, maxN, std::chrono::steady_clock::now() + timeout);
+        }
+
+        /***********************************************************
+         *  The same as takeBatch, but wait until "deadline" if the
+         *  queue is empty. Return false if nothing was taken.
+         ***********************************************************/
+        template <typename Clock, typename Duration>
+        bool tryTakeBatchUntil(std::vector<T>& out, int maxN, const std::chrono::time_point<Clock, Duration>& deadline) {
+            out.clear();
+            if (maxN < 1) {
+                return false;
+            }
+            bool spun = false;
+            std::chrono::steady_clock::time_point since;
+            while (!need_to_stop) {
+                tryTakeMany(out, maxN);
+                if (!out.empty()) {
+                    break;
+                }
+                if (!spun) {
+                    since = waitStarted();
+                    spin(untilDeadline([this] { return !empty(); }, deadline));
+                    spun = true;
+                    continue;
+                }
+                if (!parkUntil(waiting_takers, not_empty, [this] { return !empty(); }, deadline)) {
+                    tryTakeMany(out, maxN);
+                    break;
+                }
+            }
+            waitEnded(since, false);
+            return !out.empty();
+        }
+
+        /***********************************************************
+         *  Start queue
+         ***********************************************************/
+        void start() {
+            need_to_stop = false;
+        }
+
+        /***********************************************************
+         *  Stop all operations
+         ***********************************************************/
+        void stop() {
+            if (!need_to_stop.exchange(true)) {
+                // Unblocks all threads waiting currently
+                std::lock_guard<std::mutex> lock(park_mutex);
+                for (int i = 0; i < max_lanes; ++i) {
+                    my_lanes[i].not_full.notify_all();
+                }
+                not_empty.notify_all();
+            }
+        }
+
+        // Get the (approximate) size of queue
+        int getSize() const {
+            int size = 0;
+            int count_of_lanes = lane_count.load(std::memory_order_acquire);
+            for (int i = 0; i < count_of_lanes; ++i) {
+                size += my_lanes[i].size();
+            }
+            return size;
+        }
+
+        // Return true is lane 0, where put() goes by default, is full.
+        bool isFull() const {
+            return full(my_lanes[0]);
+        }
+
+        // Return true is the queue is empty.
+        bool isEmpty() const {
+            return empty();
+        }
+
+        // Get the max size of each lane.
+        int getMaxSize() const {
+            return static_cast<int>(size_limit.load(std::memory_order_relaxed));
+        }
+
+        /***********************************************************
+         *  Set the max size of each lane. It is rounded up to a
+         *  power of two like the capacity, and the capacity that
+         *  was allocated at construction is the most it can be.
+         ***********************************************************/
+        void setMaxSize(int maxSize) {
+            size_limit.store(std::min(roundUpCapacity(maxSize), my_capacity), std::memory_order_relaxed);
+            // Producers waiting for room may have got some.
+            std::lock_guard<std::mutex> lock(park_mutex);
+            for (int i = 0; i < max_lanes; ++i) {
+                my_lanes[i].not_full.notify_all();
+            }
+        }
+
+        // Set how threads wait before parking.
+        void setWaitStrategy(WaitStrategy strategy) {
+            wait_strategy.store(strategy, std::memory_order_relaxed);
+        }
+
+        // Get how threads wait before parking.
+        WaitStrategy getWaitStrategy() const {
+            return wait_strategy.load(std::memory_order_relaxed);
+        }
+
+        /***********************************************************
+         *  Give the queue one lane per weight (at most 8). put()
+         *  and the other producers choose a lane (0 by default),
+         *  and takers share their turns between lanes by weight:
+         *  with weights {16, 4, 1}, each round of 21 takes starts
+         *  with lane 0 16 times, and a turn whose lane is empty
+         *  goes to the next lane. Elements keep their order within
+         *  a lane.
+         *
+         *  Unlike SyncQueue, lanes are only ever added: lanes left
+         *  out of a shorter list keep their elements and get the
+         *  weight 1. Adding lanes allocates their slots.
+         ***********************************************************/
+        void setLanes(const std::vector<int>& weights) {
+            std::lock_guard<std::mutex> lock(park_mutex);
+            int current = lane_count.load();
+            int count_of_lanes = std::min(std::max(static_cast<int>(weights.size()), 1), max_lanes);
+            for (int i = current; i < count_of_lanes; ++i) {
+                my_lanes[i].allocate(my_capacity);
+            }
+            for (int i = 0; i < std::max(current, count_of_lanes); ++i) {
+                int weight = i < static_cast<int>(weights.size()) ? std::max(weights[i], 1) : 1;
+                my_lanes[i].weight.store(weight, std::memory_order_relaxed);
+            }
+            if (count_of_lanes > current) {
+                lane_count.store(count_of_lanes, std::memory_order_release);
+            }
+        }
+
+        // Get the number of lanes.
+        int getLaneCount() const {
+            return lane_count.load();
+        }
+
+        /***********************************************************
+         *  Start or stop counting operations and the time threads
+         *  wait on a full or empty queue. Disabling keeps what was
+         *  counted so far; resetMetrics() forgets it. While they
+         *  are enabled, every operation adds to a counter shared by
+         *  all threads.
+         ***********************************************************/
+        void setMetricsEnabled(bool enabled) {
+            std::lock_guard<std::mutex> lock(park_mutex);
+            if (enabled && !my_metrics) {
+                my_metrics.reset(new Recording());
+            }
+            recording.store(enabled ? my_metrics.get() : nullptr);
+        }
+
+        // Return true if metrics are enabled.
+        bool isMetricsEnabled() const {
+            return recording.load() != nullptr;
+        }
+
+        // Get what was counted so far (nothing if never enabled).
+        QueueMetrics getMetrics() {
+            std::lock_guard<std::mutex> lock(park_mutex);
+            QueueMetrics metrics;
+            if (my_metrics) {
+                metrics.puts = my_metrics->puts.load(std::memory_order_relaxed);
+                metrics.takes = my_metrics->takes.load(std::memory_order_relaxed);
+                my_metrics->blocked_on_full.snapshot(metrics.blocked_on_full);
+                my_metrics->blocked_on_empty.snapshot(metrics.blocked_on_empty);
+            }
+            return metrics;
+        }
+
+        // Forget what was counted so far.
+        void resetMetrics() {
+            std::lock_guard<std::mutex> lock(park_mutex);
+            if (my_metrics) {
+                my_metrics->reset();
+            }
+        }
+
+        // Clear all the elements.
+        void clear() {
+            int taken[max_lanes] = {};
+            auto drop = [](T&&) {};
+            while (Lane* lane = tryTakeHelper(drop)) {
+                ++taken[lane - my_lanes.get()];
+            }
+            wakeLanes(taken);
+        }
+
+    };
+}
+
+#endif
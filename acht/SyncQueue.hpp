@@ -2,55 +2,353 @@
 #define _SYNC_QUEUE_HPP_
 
 #include <queue>
+#include <deque>
+#include <vector>
 #include <mutex>
 #include <condition_variable>
 #include <functional>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <algorithm>
+#include <type_traits>
+#include "WaitStrategy.hpp"
+#include "Metrics.hpp"
+#include "MemoryPool.hpp"
 
 namespace acht {
 
     template <typename T>
     class SyncQueue {
+    public:
+        // A queue whose nodes come from the MemoryPool, as the lanes
+        // use. takeAll() into one of these takes no copy.
+        using Queue = std::queue<T, std::deque<T, PoolAllocator<T>>>;
+
     private:
-        std::queue<T> my_queue;
+        // Elements are kept in one or more lanes, drained by weight
+        // (see setLanes). "queue_size" counts all of them.
+        std::deque<Queue> my_lanes;
+        std::vector<int> lane_weights;
+        std::vector<int> lane_credits;
+        int queue_size;
         int queue_max_size;
         mutable std::mutex my_mutex;
         std::condition_variable not_empty;
         std::condition_variable not_full;
+        int waiting_putters;
+        int waiting_takers;
         bool need_to_stop;
+        std::atomic<int> approx_size;
+        WaitStrategy wait_strategy;
+
+        // Allocated when metrics are first enabled, and kept when
+        // they are disabled. Operations count into "recording",
+        // which is null while metrics are disabled. Both are only
+        // touched with the lock held, which every operation holds
+        // anyway, so counting adds no contention.
+        std::unique_ptr<QueueMetrics> my_metrics;
+        QueueMetrics* recording;
 
         /***********************************************************
          *  A helper function that adds element to the queue,
          *  waiting if queue is full.
          ***********************************************************/
         template <typename Type>
-        void putHelper(Type&& elem) {
+        void putHelper(Type&& elem, int lane) {
             std::unique_lock<std::mutex> lock(my_mutex);
-            while (!need_to_stop && full()) {
-                not_full.wait(lock);
-            }
-            if (need_to_stop) {
+            if (!waitNotFull(lock)) {
                 return;
             }
-            my_queue.emplace(std::forward<Type>(elem));
-            not_empty.notify_one();
+            emplaceLocked(std::forward<Type>(elem), lane);
+        }
+
+        /***********************************************************
+         *  A helper function that adds element to the queue,
+         *  waiting until the deadline if queue is full.
+         ***********************************************************/
+        template <typename Type, typename Clock, typename Duration>
+        bool tryPutHelper(Type&& elem, const std::chrono::time_point<Clock, Duration>& deadline, int lane) {
+            std::unique_lock<std::mutex> lock(my_mutex);
+            auto park = [&] {
+                return waitUntil(not_full, waiting_putters, lock, deadline);
+            };
+            if (!waitReady(lock, [this] { return !full(); }, untilDeadline(notFullHint(), deadline), park, true)) {
+                return false;
+            }
+            emplaceLocked(std::forward<Type>(elem), lane);
+            return true;
+        }
+
+        /***********************************************************
+         *  Add the element to a lane and wake up a consumer. The lock
+         *  must be held and the queue must not be full.
+         ***********************************************************/
+        template <typename Type>
+        void emplaceLocked(Type&& elem, int lane) {
+            pushLocked(std::forward<Type>(elem), lane);
+            updateSize();
+            if (recording) {
+                ++recording->puts;
+            }
+            if (waiting_takers > 0) {
+                not_empty.notify_one();
+            }
+        }
+
+        /***********************************************************
+         *  Remove the head element into "elem" and wake up a
+         *  producer. The lock must be held and the queue must not
+         *  be empty.
+         ***********************************************************/
+        void popLocked(T& elem) {
+            Queue& lane = my_lanes[nextLane()];
+            elem = std::move(lane.front());
+            lane.pop();
+            --queue_size;
+            updateSize();
+            if (recording) {
+                ++recording->takes;
+            }
+            if (waiting_putters > 0) {
+                not_full.notify_one();
+            }
+        }
+
+        /***********************************************************
+         *  Move up to "maxN" elements into "out" and wake up as many
+         *  producers. The lock must be held.
+         ***********************************************************/
+        void takeBatchLocked(std::vector<T>& out, int maxN) {
+            while (!empty() && static_cast<int>(out.size()) < maxN) {
+                Queue& lane = my_lanes[nextLane()];
+                out.emplace_back(std::move(lane.front()));
+                lane.pop();
+                --queue_size;
+            }
+            updateSize();
+            if (recording) {
+                recording->takes += out.size();
+            }
+            notifyMany(not_full, waiting_putters, out.size());
+        }
+
+        /***********************************************************
+         *  Publish the queue size for threads spinning without the
+         *  lock. The lock must be held.
+         ***********************************************************/
+        void updateSize() {
+            approx_size.store(queue_size, std::memory_order_relaxed);
+        }
+
+        /***********************************************************
+         *  Add the element to the given lane (the last lane if
+         *  there is no such lane). The lock must be held.
+         ***********************************************************/
+        template <typename Type>
+        void pushLocked(Type&& elem, int lane) {
+            int last = static_cast<int>(my_lanes.size()) - 1;
+            my_lanes[lane < 0 ? 0 : (lane > last ? last : lane)].emplace(std::forward<Type>(elem));
+            ++queue_size;
+        }
+
+        /***********************************************************
+         *  Choose the lane to take from with smooth weighted round
+         *  robin: every non-empty lane earns its weight in credits,
+         *  the richest lane is chosen and pays the weights of all
+         *  non-empty lanes. Over any stretch where lanes stay busy,
+         *  each gets its weight's share of takes, so a low lane is
+         *  slowed down but never starved.
+         ***********************************************************/
+        int nextLane() {
+            int count = static_cast<int>(my_lanes.size());
+            if (count == 1) {
+                return 0;
+            }
+            int best = -1;
+            int total = 0;
+            for (int i = 0; i < count; ++i) {
+                if (my_lanes[i].empty()) {
+                    continue;
+                }
+                lane_credits[i] += lane_weights[i];
+                total += lane_weights[i];
+                if (best < 0 || lane_credits[i] > lane_credits[best]) {
+                    best = i;
+                }
+            }
+            lane_credits[best] -= total;
+            return best;
+        }
+
+        /***********************************************************
+         *  Wait on the condition variable while being counted as a
+         *  waiter, so that notifications can be sized to the number
+         *  of threads actually waiting.
+         ***********************************************************/
+        void waitFor(std::condition_variable& cond, int& waiting, std::unique_lock<std::mutex>& lock) {
+            ++waiting;
+            cond.wait(lock);
+            --waiting;
+        }
+
+        /***********************************************************
+         *  The same as waitFor, but give up at the deadline. Return
+         *  false if the deadline passed.
+         ***********************************************************/
+        template <typename Clock, typename Duration>
+        bool waitUntil(std::condition_variable& cond, int& waiting, std::unique_lock<std::mutex>& lock,
+                       const std::chrono::time_point<Clock, Duration>& deadline) {
+            if (Clock::now() >= deadline) {
+                return false;
+            }
+            ++waiting;
+            std::cv_status status = cond.wait_until(lock, deadline);
+            --waiting;
+            return status == std::cv_status::no_timeout;
+        }
+
+        /***********************************************************
+         *  Wake up as many waiters as there are new elements (or
+         *  free slots), but no more than the waiters we have.
+         ***********************************************************/
+        void notifyMany(std::condition_variable& cond, int waiting, int count) {
+            if (count >= waiting) {
+                cond.notify_all();
+            }
+            else {
+                for (int i = 0; i < count; ++i) {
+                    cond.notify_one();
+                }
+            }
+        }
+
+        /***********************************************************
+         *  Wait until "ready" holds or the queue is stopped. The
+         *  lock is released while spinning according to the wait
+         *  strategy, watching "hint" which must not need the lock.
+         *  After that "park" is called until "ready" holds; it
+         *  returns false when the caller's deadline has passed.
+         *  With metrics enabled, the time waited is recorded as
+         *  blocked on full if "putting" is true, else on empty.
+         *
+         *  Return true if the operation can go on.
+         ***********************************************************/
+        template <typename Ready, typename Hint, typename Park>
+        bool waitReady(std::unique_lock<std::mutex>& lock, Ready ready, Hint hint, Park park, bool putting) {
+            if (need_to_stop || ready()) {
+                return !need_to_stop;
+            }
+            bool timed = recording != nullptr;
+            std::chrono::steady_clock::time_point since;
+            if (timed) {
+                since = std::chrono::steady_clock::now();
+            }
+            if (wait_strategy.spins()) {
+                WaitStrategy strategy = wait_strategy;
+                lock.unlock();
+                strategy.spinUntil(hint);
+                lock.lock();
+            }
+            bool can_go_on = true;
+            while (!need_to_stop && !ready()) {
+                if (!park()) {
+                    can_go_on = ready();
+                    break;
+                }
+            }
+            can_go_on = can_go_on && !need_to_stop;
+            if (timed && recording) {
+                auto waited = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - since);
+                Histogram& blocked = putting ? recording->blocked_on_full : recording->blocked_on_empty;
+                blocked.record(static_cast<std::uint64_t>(waited.count()));
+            }
+            return can_go_on;
+        }
+
+        /***********************************************************
+         *  A predicate telling spinning producers that the queue
+         *  has room again. It is read without the lock.
+         ***********************************************************/
+        auto notFullHint() const {
+            int max_size = queue_max_size;
+            return [this, max_size] {
+                return approx_size.load(std::memory_order_relaxed) < max_size;
+            };
+        }
+
+        /***********************************************************
+         *  Wait if the queue is full. Return false if the queue was
+         *  stopped.
+         ***********************************************************/
+        bool waitNotFull(std::unique_lock<std::mutex>& lock) {
+            auto park = [&] {
+                waitFor(not_full, waiting_putters, lock);
+                return true;
+            };
+            return waitReady(lock, [this] { return !full(); }, notFullHint(), park, true);
+        }
+
+        /***********************************************************
+         *  Wait if the queue is empty in blocking mode. Return false
+         *  if nothing can be taken.
+         ***********************************************************/
+        bool waitNotEmpty(std::unique_lock<std::mutex>& lock, bool blocking) {
+            if (!blocking) {
+                // non-blocking mode
+                return !need_to_stop && !empty();
+            }
+            // blocking mode
+            auto park = [&] {
+                waitFor(not_empty, waiting_takers, lock);
+                return true;
+            };
+            return waitReady(lock, [this] { return !empty(); }, notEmptyHint(), park, false);
+        }
+
+        /***********************************************************
+         *  Wait until the deadline if the queue is empty. Return
+         *  false if nothing can be taken.
+         ***********************************************************/
+        template <typename Clock, typename Duration>
+        bool waitNotEmptyUntil(std::unique_lock<std::mutex>& lock,
+                               const std::chrono::time_point<Clock, Duration>& deadline) {
+            auto park = [&] {
+                return waitUntil(not_empty, waiting_takers, lock, deadline);
+            };
+            return waitReady(lock, [this] { return !empty(); }, untilDeadline(notEmptyHint(), deadline), park, false);
+        }
+
+        /***********************************************************
+         *  A predicate telling spinning consumers that the queue
+         *  has elements again. It is read without the lock.
+         ***********************************************************/
+        auto notEmptyHint() const {
+            return [this] {
+                return approx_size.load(std::memory_order_relaxed) > 0;
+            };
         }
 
         /***********************************************************
          *  Check if the queue is full without lock.
          ***********************************************************/
         bool full() const {
-            return my_queue.size() == queue_max_size;
+            return queue_size >= queue_max_size;
         }
 
         /***********************************************************
          *  Check if the queue is empty without lock.
          ***********************************************************/
         bool empty() const {
-            return my_queue.size() == 0;
+            return queue_size == 0;
         }
 
     public:
-        SyncQueue(int maxSize) : queue_max_size(maxSize), need_to_stop(false) {}
+        SyncQueue(int maxSize, WaitStrategy strategy = WaitStrategy())
+        : my_lanes(1), lane_weights(1, 1), lane_credits(1, 0), queue_size(0), queue_max_size(maxSize),
+          waiting_putters(0), waiting_takers(0), need_to_stop(false), approx_size(0), wait_strategy(strategy),
+          recording(nullptr) {}
 
         ~SyncQueue() {
             // If the queue wasn't stoped, then stop it.
@@ -64,15 +362,15 @@ namespace acht {
         SyncQueue& operator=(const SyncQueue&) = delete;
 
         /***********************************************************
-         *  Add the given element to this queue,
+         *  Add the given element to this queue (to the given lane),
          *  waiting if queue is full.
          ***********************************************************/
-        void put(const T& elem) {
-            putHelper(elem);
+        void put(const T& elem, int lane = 0) {
+            putHelper(elem, lane);
         }
 
-        void put(T&& elem) {
-            putHelper(std::forward<T>(elem));
+        void put(T&& elem, int lane = 0) {
+            putHelper(std::forward<T>(elem), lane);
         }
 
         /***********************************************************
@@ -84,55 +382,216 @@ namespace acht {
          ***********************************************************/
         bool take(T& elem, bool blocking = true) {
             std::unique_lock<std::mutex> lock(my_mutex);
-            if (blocking) {
-                // blocking mode
-                while (!need_to_stop && empty()) {
-                    not_empty.wait(lock);
-                }
-            }
-            else {
-                // non-blocking mode
-                if (empty()) {
-                    return false;
-                }
-            }
-            if (need_to_stop) {
+            if (!waitNotEmpty(lock, blocking)) {
                 return false;
             }
             // Take element
-            elem = my_queue.front();
-            my_queue.pop();
-            not_full.notify_one();
+            popLocked(elem);
             return true;
         }
 
         /***********************************************************
-         *  Retrieve and remove all elements of this queue.
+         *  Add the given element to this queue, waiting at most
+         *  "timeout" if queue is full. Return false if the element
+         *  was not added.
+         ***********************************************************/
+        template <typename Rep, typename Period>
+        bool tryPutFor(const T& elem, const std::chrono::duration<Rep, Period>& timeout, int lane = 0) {
+            return tryPutHelper(elem, std::chrono::steady_clock::now() + timeout, lane);
+        }
+
+        template <typename Rep, typename Period>
+        bool tryPutFor(T&& elem, const std::chrono::duration<Rep, Period>& timeout, int lane = 0) {
+            return tryPutHelper(std::move(elem), std::chrono::steady_clock::now() + timeout, lane);
+        }
+
+        /***********************************************************
+         *  Add the given element to this queue, waiting until
+         *  "deadline" if queue is full. Return false if the element
+         *  was not added.
+         ***********************************************************/
+        template <typename Clock, typename Duration>
+        bool tryPutUntil(const T& elem, const std::chrono::time_point<Clock, Duration>& deadline, int lane = 0) {
+            return tryPutHelper(elem, deadline, lane);
+        }
+
+        template <typename Clock, typename Duration>
+        bool tryPutUntil(T&& elem, const std::chrono::time_point<Clock, Duration>& deadline, int lane = 0) {
+            return tryPutHelper(std::move(elem), deadline, lane);
+        }
+
+        /***********************************************************
+         *  Retrieve and remove the head of this queue, waiting at
+         *  most "timeout" if the queue is empty. Return false if
+         *  nothing was taken.
+         ***********************************************************/
+        template <typename Rep, typename Period>
+        bool tryTakeFor(T& elem, const std::chrono::duration<Rep, Period>& timeout) {
+            return tryTakeUntil(elem, std::chrono::steady_clock::now() + timeout);
+        }
+
+        /***********************************************************
+         *  Retrieve and remove the head of this queue, waiting until
+         *  "deadline" if the queue is empty. Return false if nothing
+         *  was taken.
+         ***********************************************************/
+        template <typename Clock, typename Duration>
+        bool tryTakeUntil(T& elem, const std::chrono::time_point<Clock, Duration>& deadline) {
+            std::unique_lock<std::mutex> lock(my_mutex);
+            if (!waitNotEmptyUntil(lock, deadline)) {
+                return false;
+            }
+            popLocked(elem);
+            return true;
+        }
+
+        /***********************************************************
+         *  Retrieve and remove all elements of this queue. With
+         *  several lanes they are moved out in the order they would
+         *  have been taken one by one.
          *
          *  There are two modes for this operation: Blocked or not.
          *  If "blocking" is true, then wait if the queue is empty.
          *  If "blocking" is false, then give up if the queue is empty.
          ***********************************************************/
-        bool takeAll(std::queue<T> &other_queue, bool blocking = true) {
+        template <typename Container>
+        bool takeAll(std::queue<T, Container> &other_queue, bool blocking = true) {
             std::unique_lock<std::mutex> lock(my_mutex);
-            if (blocking) {
-                // blocking mode
-                while (!need_to_stop && empty()) {
-                    not_empty.wait(lock);
+            if (!waitNotEmpty(lock, blocking)) {
+                return false;
+            }
+            // Take all elements
+            int count = queue_size;
+            bool moved = false;
+            if constexpr (std::is_same<std::queue<T, Container>, Queue>::value) {
+                if (my_lanes.size() == 1) {
+                    other_queue = std::move(my_lanes[0]);
+                    my_lanes[0] = Queue();
+                    queue_size = 0;
+                    moved = true;
                 }
             }
-            else {
-                // non-blocking mode
-                if (empty()) {
-                    return false;
+            if (!moved) {
+                other_queue = std::queue<T, Container>();
+                while (!empty()) {
+                    Queue& lane = my_lanes[nextLane()];
+                    other_queue.push(std::move(lane.front()));
+                    lane.pop();
+                    --queue_size;
                 }
             }
-            if (need_to_stop) {
+            updateSize();
+            if (recording) {
+                recording->takes += count;
+            }
+            notifyMany(not_full, waiting_putters, count);
+            return true;
+        }
+
+        /***********************************************************
+         *  Add the elements in [first, last) to this queue under a
+         *  single lock acquisition, waiting whenever the queue is
+         *  full. Pass move iterators to move the elements in.
+         *
+         *  Return the number of elements added, which is less than
+         *  the length of the range only if the queue was stopped.
+         ***********************************************************/
+        template <typename InputIt>
+        int putBatch(InputIt first, InputIt last, int lane = 0) {
+            std::unique_lock<std::mutex> lock(my_mutex);
+            int count = 0;
+            int pending = 0;
+            for (; first != last; ++first) {
+                if (full()) {
+                    // Let consumers drain what we added so far.
+                    notifyMany(not_empty, waiting_takers, pending);
+                    pending = 0;
+                }
+                if (!waitNotFull(lock)) {
+                    break;
+                }
+                pushLocked(*first, lane);
+                updateSize();
+                ++count;
+                ++pending;
+            }
+            if (recording) {
+                recording->puts += count;
+            }
+            notifyMany(not_empty, waiting_takers, pending);
+            return count;
+        }
+
+        /***********************************************************
+         *  Add as many elements of [first, last) as fit into this
+         *  queue under a single lock acquisition, without waiting.
+         *  Return the number of elements added.
+         ***********************************************************/
+        template <typename InputIt>
+        int tryPutBatch(InputIt first, InputIt last, int lane = 0) {
+            std::unique_lock<std::mutex> lock(my_mutex);
+            int count = 0;
+            for (; first != last && !need_to_stop && !full(); ++first) {
+                pushLocked(*first, lane);
+                ++count;
+            }
+            updateSize();
+            if (recording) {
+                recording->puts += count;
+            }
+            notifyMany(not_empty, waiting_takers, count);
+            return count;
+        }
+
+        /***********************************************************
+         *  Retrieve and remove up to "maxN" elements from the head
+         *  of this queue into "out". The vector is cleared first, so
+         *  the same vector can be reused across calls without
+         *  reallocating.
+         *
+         *  There are two modes for this operation: Blocked or not.
+         *  If "blocking" is true, then wait if the queue is empty.
+         *  If "blocking" is false, then give up if the queue is empty.
+         *  Nothing is taken, and false returned, if "maxN" is less
+         *  than 1.
+         ***********************************************************/
+        bool takeBatch(std::vector<T>& out, int maxN, bool blocking = true) {
+            out.clear();
+            if (maxN < 1) {
                 return false;
             }
-            // Take all elements
-            other_queue = std::move(my_queue);
-            not_full.notify_one();
+            std::unique_lock<std::mutex> lock(my_mutex);
+            if (!waitNotEmpty(lock, blocking)) {
+                return false;
+            }
+            takeBatchLocked(out, maxN);
+            return true;
+        }
+
+        /***********************************************************
+         *  The same as takeBatch, but wait at most "timeout" if the
+         *  queue is empty. Return false if nothing was taken.
+         ***********************************************************/
+        template <typename Rep, typename Period>
+        bool tryTakeBatchFor(std::vector<T>& out, int maxN, const std::chrono::duration<Rep, Period>& timeout) {
+            return tryTakeBatchUntil(out, maxN, std::chrono::steady_clock::now() + timeout);
+        }
+
+        /***********************************************************
+         *  The same as takeBatch, but wait until "deadline" if the
+         *  queue is empty. Return false if nothing was taken.
+         ***********************************************************/
+        template <typename Clock, typename Duration>
+        bool tryTakeBatchUntil(std::vector<T>& out, int maxN, const std::chrono::time_point<Clock, Duration>& deadline) {
+            out.clear();
+            if (maxN < 1) {
+                return false;
+            }
+            std::unique_lock<std::mutex> lock(my_mutex);
+            if (!waitNotEmptyUntil(lock, deadline)) {
+                return false;
+            }
+            takeBatchLocked(out, maxN);
             return true;
         }
 
@@ -164,19 +623,19 @@ namespace acht {
         // Get the size of queue
         int getSize() const {
             std::lock_guard<std::mutex> lock(my_mutex);
-            return my_queue.size();
+            return queue_size;
         }
 
         // Return true is the queue is full.
         bool isFull() const {
             std::lock_guard<std::mutex> lock(my_mutex);
-            return my_queue.size() == queue_max_size;
+            return full();
         }
 
         // Return true is the queue is empty.
         bool isEmpty() const {
             std::lock_guard<std::mutex> lock(my_mutex);
-            return my_queue.size() == 0;
+            return queue_size == 0;
         }
 
         // Get the max size of the queue.
@@ -191,12 +650,96 @@ namespace acht {
             queue_max_size = maxSize;
         }
 
+        // Set how threads wait before parking.
+        void setWaitStrategy(WaitStrategy strategy) {
+            std::lock_guard<std::mutex> lock(my_mutex);
+            wait_strategy = strategy;
+        }
+
+        // Get how threads wait before parking.
+        WaitStrategy getWaitStrategy() const {
+            std::lock_guard<std::mutex> lock(my_mutex);
+            return wait_strategy;
+        }
+
+        /***********************************************************
+         *  Split the queue into one lane per weight. put() and the
+         *  other producers choose a lane (0 by default), and takers
+         *  drain busy lanes in proportion to their weights: with
+         *  weights {16, 4, 1}, lane 0 gets 16 of every 21 takes
+         *  while all three lanes have elements. Elements keep their
+         *  order within a lane. Elements of lanes that no longer
+         *  exist move to the new last lane.
+         ***********************************************************/
+        void setLanes(const std::vector<int>& weights) {
+            std::lock_guard<std::mutex> lock(my_mutex);
+            std::size_t count = std::max<std::size_t>(weights.size(), 1);
+            while (my_lanes.size() > count) {
+                Queue& removed = my_lanes.back();
+                Queue& last = my_lanes[count - 1];
+                while (!removed.empty()) {
+                    last.push(std::move(removed.front()));
+                    removed.pop();
+                }
+                my_lanes.pop_back();
+            }
+            my_lanes.resize(count);
+            lane_weights.assign(count, 1);
+            for (std::size_t i = 0; i < weights.size(); ++i) {
+                lane_weights[i] = std::max(weights[i], 1);
+            }
+            lane_credits.assign(count, 0);
+        }
+
+        // Get the number of lanes.
+        int getLaneCount() const {
+            std::lock_guard<std::mutex> lock(my_mutex);
+            return static_cast<int>(my_lanes.size());
+        }
+
+        /***********************************************************
+         *  Start or stop counting operations and the time threads
+         *  wait on a full or empty queue. Disabling keeps what was
+         *  counted so far; resetMetrics() forgets it.
+         ***********************************************************/
+        void setMetricsEnabled(bool enabled) {
+            std::lock_guard<std::mutex> lock(my_mutex);
+            if (enabled && !my_metrics) {
+                my_metrics.reset(new QueueMetrics());
+            }
+            recording = enabled ? my_metrics.get() : nullptr;
+        }
+
+        // Return true if metrics are enabled.
+        bool isMetricsEnabled() const {
+            std::lock_guard<std::mutex> lock(my_mutex);
+            return recording != nullptr;
+        }
+
+        // Get what was counted so far (nothing if never enabled).
+        QueueMetrics getMetrics() const {
+            std::lock_guard<std::mutex> lock(my_mutex);
+            return my_metrics ? *my_metrics : QueueMetrics();
+        }
+
+        // Forget what was counted so far.
+        void resetMetrics() {
+            std::lock_guard<std::mutex> lock(my_mutex);
+            if (my_metrics) {
+                *my_metrics = QueueMetrics();
+            }
+        }
+
         // Clear all the elements.
         void clear() {
             std::lock_guard<std::mutex> lock(my_mutex);
-            while (!my_queue.empty()) {
-                my_queue.pop();
+            int count = queue_size;
+            for (auto& lane : my_lanes) {
+                lane = Queue();
             }
+            queue_size = 0;
+            updateSize();
+            notifyMany(not_full, waiting_putters, count);
         }
 
     };
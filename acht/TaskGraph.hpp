@@ -0,0 +1,193 @@
+#ifndef _TASK_GRAPH_HPP_
+#define _TASK_GRAPH_HPP_
+
+#include "ThreadPool.hpp"
+#include "Parallel.hpp"
+#include <deque>
+#include <vector>
+#include <atomic>
+#include <stdexcept>
+#include <initializer_list>
+#include <utility>
+
+namespace acht {
+
+    /***********************************************************
+     *  A directed acyclic graph of tasks run on a thread pool.
+     *
+     *  Tasks are added once with the tasks they depend on, and the
+     *  graph can then be run any number of times. A task is
+     *  submitted as soon as the last task it depends on finishes,
+     *  so no worker ever blocks waiting for a predecessor. The
+     *  worker that finishes a task runs one of the newly ready
+     *  tasks itself instead of queueing it.
+     *
+     *  A graph must not be changed or run again while it runs.
+     ***********************************************************/
+    class TaskGraph {
+    private:
+        struct Node {
+            UniqueTask work;
+            std::vector<int> successors;
+            int predecessors = 0;
+            std::atomic<int> remaining{0};
+        };
+
+        std::deque<Node> my_nodes;
+        std::vector<int> my_roots;
+        bool checked;
+
+        /***********************************************************
+         *  Run the task and every newly ready successor chain on
+         *  the calling thread. The other ready successors are
+         *  submitted to the group.
+         ***********************************************************/
+        void execute(TaskGroup& group, int id) {
+            while (id >= 0) {
+                Node& node = my_nodes[id];
+                node.work();
+                int next = -1;
+                for (int successor : node.successors) {
+                    if (my_nodes[successor].remaining.fetch_sub(1) == 1) {
+                        if (next < 0) {
+                            next = successor;
+                        }
+                        else {
+                            schedule(group, successor);
+                        }
+                    }
+                }
+                id = next;
+            }
+        }
+
+        void schedule(TaskGroup& group, int id) {
+            group.run([this, &group, id] {
+                execute(group, id);
+            });
+        }
+
+        /***********************************************************
+         *  Find the tasks without predecessors and make sure there
+         *  is no cycle (Kahn's algorithm). Only done after the graph
+         *  changed.
+         ***********************************************************/
+        void check() {
+            if (checked) {
+                return;
+            }
+            my_roots.clear();
+            std::vector<int> waiting(my_nodes.size());
+            std::vector<int> ready;
+            for (std::size_t i = 0; i < my_nodes.size(); ++i) {
+                waiting[i] = my_nodes[i].predecessors;
+                if (waiting[i] == 0) {
+                    my_roots.push_back(static_cast<int>(i));
+                    ready.push_back(static_cast<int>(i));
+                }
+            }
+            std::size_t visited = 0;
+            while (!ready.empty()) {
+                int id = ready.back();
+                ready.pop_back();
+                ++visited;
+                for (int successor : my_nodes[id].successors) {
+                    if (--waiting[successor] == 0) {
+                        ready.push_back(successor);
+                    }
+                }
+            }
+            if (visited != my_nodes.size()) {
+                throw std::logic_error("TaskGraph contains a cycle");
+            }
+            checked = true;
+        }
+
+        void checkId(int id) const {
+            if (id < 0 || id >= static_cast<int>(my_nodes.size())) {
+                throw std::out_of_range("TaskGraph has no task with this id");
+            }
+        }
+
+    public:
+        TaskGraph() : checked(true) {}
+
+        // No copy
+        TaskGraph(const TaskGraph&) = delete;
+
+        // No assignment
+        TaskGraph& operator=(const TaskGraph&) = delete;
+
+        /***********************************************************
+         *  Add a task and return its id. The callable is invoked
+         *  once per run.
+         ***********************************************************/
+        template <typename F>
+        int addTask(F&& func) {
+            my_nodes.emplace_back();
+            my_nodes.back().work = UniqueTask(std::forward<F>(func));
+            checked = false;
+            return static_cast<int>(my_nodes.size()) - 1;
+        }
+
+        /***********************************************************
+         *  Add a task that runs after all the given tasks, and
+         *  return its id.
+         ***********************************************************/
+        template <typename F>
+        int addTask(F&& func, std::initializer_list<int> dependencies) {
+            for (int before : dependencies) {
+                checkId(before);
+            }
+            int id = addTask(std::forward<F>(func));
+            for (int before : dependencies) {
+                addDependency(before, id);
+            }
+            return id;
+        }
+
+        /***********************************************************
+         *  Make task "after" run only once task "before" finished.
+         ***********************************************************/
+        void addDependency(int before, int after) {
+            checkId(before);
+            checkId(after);
+            my_nodes[before].successors.push_back(after);
+            ++my_nodes[after].predecessors;
+            checked = false;
+        }
+
+        /***********************************************************
+         *  Run the whole graph on the pool and return when every
+         *  task has finished. The calling thread runs queued tasks
+         *  while it waits. If a task throws, the tasks depending on
+         *  it are skipped and the first exception is rethrown. The
+         *  same goes for a task that a shut down pool drops.
+         ***********************************************************/
+        void run(ThreadPool& pool) {
+            check();
+            for (Node& node : my_nodes) {
+                node.remaining.store(node.predecessors, std::memory_order_relaxed);
+            }
+            TaskGroup group(pool);
+            for (int root : my_roots) {
+                schedule(group, root);
+            }
+            group.wait();
+        }
+
+        // Get the number of tasks.
+        int getTaskCount() const {
+            return static_cast<int>(my_nodes.size());
+        }
+
+        // Remove all tasks.
+        void clear() {
+            my_nodes.clear();
+            my_roots.clear();
+            checked = true;
+        }
+    };
+}
+
+#endif
@@ -1,53 +1,765 @@
 #ifndef _THREAD_POOL_HPP_
 #define _THREAD_POOL_HPP_
 
-#include "SyncQueue.hpp"
+#include "BlockingQueue.hpp"
+#include "WorkStealingQueue.hpp"
+#include "UniqueTask.hpp"
+#include "Topology.hpp"
+#include "Metrics.hpp"
+#include "TimerWheel.hpp"
 #include <vector>
 #include <memory>
 #include <thread>
 #include <atomic>
+#include <future>
+#include <tuple>
+#include <type_traits>
+#include <chrono>
+#include <shared_mutex>
+#include <algorithm>
+#include <iterator>
+#include <utility>
+
+#if defined(__cpp_impl_coroutine)
+#include <coroutine>
+#endif
 
 namespace acht {
 
     class ThreadPool {
+    public:
+        /***********************************************************
+         *  How workers get their tasks.
+         *
+         *  SharedQueue: every worker takes tasks from one shared
+         *  task queue.
+         *
+         *  WorkStealing: every worker also has its own deque. Tasks
+         *  submitted from a worker go to that worker's deque, and
+         *  idle workers steal from the others. Tasks submitted from
+         *  outside the pool still go to the shared queue.
+         ***********************************************************/
+        enum class Mode {
+            SharedQueue,
+            WorkStealing
+        };
+
+        /***********************************************************
+         *  Where workers run (only supported on Linux, elsewhere
+         *  workers are never pinned).
+         *
+         *  None: the OS may move workers between any CPUs.
+         *
+         *  PinCores: every worker is pinned to its own core.
+         *
+         *  NumaNodes: workers are split into one group per NUMA
+         *  node, each worker pinned to a core of its node. Every
+         *  group has its own task queue, so a task submitted to a
+         *  node runs next to the memory of that node.
+         ***********************************************************/
+        enum class Placement {
+            None,
+            PinCores,
+            NumaNodes
+        };
+
+        /***********************************************************
+         *  The lane a task is queued in. Workers drain the lanes by
+         *  weight (16, 4 and 1 by default, see setPriorityWeights),
+         *  so High tasks overtake a backlog of Normal and Low ones,
+         *  while Low tasks still get a share and never starve.
+         ***********************************************************/
+        enum class Priority {
+            High,
+            Normal,
+            Low
+        };
+
     private:
-        using Task = std::function<void()>;
+        using Clock = std::chrono::steady_clock;
+
+        // A queued task and when it was submitted (only set while
+        // metrics are enabled).
+        struct Task {
+            UniqueTask work;
+            Clock::time_point queued_at;
+        };
+
+        using LocalQueue = WorkStealingQueue<Task>;
+
+        // The metrics one worker records. Only that worker writes
+        // them, so recording costs no contention; they are summed
+        // up when read.
+        struct WorkerStats {
+            std::atomic<std::uint64_t> tasks_run{0};
+            std::atomic<std::uint64_t> tasks_stolen{0};
+            std::atomic<std::uint64_t> busy_ns{0};
+            std::atomic<std::uint64_t> idle_ns{0};
+            ConcurrentHistogram queue_wait;
+            ConcurrentHistogram execution;
+
+            void reset() {
+                tasks_run = 0;
+                tasks_stolen = 0;
+                busy_ns = 0;
+                idle_ns = 0;
+                queue_wait.reset();
+                execution.reset();
+            }
+        };
+
+        // A worker thread and the deque it owns in work-stealing mode.
+        struct Worker {
+            std::thread thread;
+            std::unique_ptr<LocalQueue> local;
+            std::unique_ptr<WorkerStats> stats{new WorkerStats()};
+            std::atomic<bool> retired{false};
+            int node = 0;
+        };
+
+        // Which pool and worker the current thread belongs to.
+        struct WorkerContext {
+            const ThreadPool* pool = nullptr;
+            int index = -1;
+            int node = 0;
+            LocalQueue* local = nullptr;
+            WorkerStats* stats = nullptr;
+        };
+
         std::atomic<bool> shutdown;
-        std::vector<std::shared_ptr<std::thread>> my_threads;
-        SyncQueue<Task> my_tasks;
+        std::vector<std::unique_ptr<Worker>> my_workers;
+        std::shared_mutex workers_mutex;
+        std::atomic<int> thread_count;
+        Mode my_mode;
+        Placement my_placement;
+
+        // One task queue and CPU set per node (a single one unless
+        // workers are placed by NUMA node).
+        std::vector<std::unique_ptr<BlockingQueue<Task>>> my_tasks;
+        std::vector<std::vector<int>> node_cpus;
+        std::unique_ptr<std::atomic<int>[]> node_workers;
+        std::atomic<unsigned> next_node;
+
+        // Only used in work-stealing mode.
+        std::atomic<int> pending_tasks;
+        std::atomic<int> idle_workers;
+        std::mutex idle_mutex;
+        std::condition_variable idle_cond;
+
+        // Bounds and thresholds for growing and shrinking the pool.
+        std::atomic<int> min_threads;
+        std::atomic<int> max_threads;
+        std::atomic<long long> keep_alive_ms;
+        std::atomic<int> grow_queue_depth;
+        std::atomic<long long> grow_wait_ms;
+        std::atomic<int> busy_workers;
+        std::atomic<Clock::rep> last_take;
+
+        // Metrics, recorded only while enabled. Threads that are not
+        // workers of this pool record into "helper_stats".
+        std::atomic<bool> metrics_enabled;
+        WorkerStats helper_stats;
+
+        // Delayed and periodic tasks, serviced by one timer thread
+        // that is started on first use.
+        TimerWheel my_timers;
+        std::thread timer_thread;
+        std::mutex timer_mutex;
+        std::condition_variable timer_cond;
+        bool timers_stopped;
+        Clock::time_point timer_wake;
+
+        static WorkerContext& currentWorker() {
+            static thread_local WorkerContext context;
+            return context;
+        }
+
+        /***********************************************************
+         *  Return the deque of the calling worker if it belongs to
+         *  this pool, or nullptr otherwise.
+         ***********************************************************/
+        LocalQueue* localQueue() const {
+            const WorkerContext& context = currentWorker();
+            return context.pool == this ? context.local : nullptr;
+        }
+
+        /***********************************************************
+         *  Return the node of the calling worker if it belongs to
+         *  this pool, or -1 otherwise.
+         ***********************************************************/
+        int workerNode() const {
+            const WorkerContext& context = currentWorker();
+            return context.pool == this ? context.node : -1;
+        }
+
+        bool metricsEnabled() const {
+            return metrics_enabled.load(std::memory_order_relaxed);
+        }
+
+        /***********************************************************
+         *  Get the metrics the calling thread records into.
+         ***********************************************************/
+        WorkerStats& callerStats() {
+            const WorkerContext& context = currentWorker();
+            return context.pool == this && context.stats ? *context.stats : helper_stats;
+        }
+
+        static std::uint64_t nanosSince(Clock::time_point since, Clock::time_point now) {
+            return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now - since).count());
+        }
+
+        /***********************************************************
+         *  Make a task that runs "func(args...)" and fulfils a
+         *  promise with the result, and set "result" to its future.
+         *  The state shared by the promise and the future comes
+         *  from the MemoryPool, like the task if it is too big to be
+         *  stored inline. A task dropped without running breaks the
+         *  promise.
+         ***********************************************************/
+        template <typename Result, typename F, typename... Args>
+        static UniqueTask makeJob(std::future<Result>& result, F&& func, Args&&... args) {
+            std::promise<Result> promise(std::allocator_arg, PoolAllocator<char>());
+            result = promise.get_future();
+            return UniqueTask([promise = std::move(promise), func = std::forward<F>(func),
+                               params = std::make_tuple(std::forward<Args>(args)...)]() mutable {
+                try {
+                    if constexpr (std::is_void<Result>::value) {
+                        std::apply(std::move(func), std::move(params));
+                        promise.set_value();
+                    }
+                    else {
+                        promise.set_value(std::apply(std::move(func), std::move(params)));
+                    }
+                }
+                catch (...) {
+                    promise.set_exception(std::current_exception());
+                }
+            });
+        }
+
+        /***********************************************************
+         *  Wrap a task for queueing, stamped with the time it was
+         *  submitted if metrics are enabled.
+         ***********************************************************/
+        Task makeTask(UniqueTask&& task) const {
+            return Task{std::move(task), metricsEnabled() ? Clock::now() : Clock::time_point()};
+        }
+
+        /***********************************************************
+         *  Add the time since "since" to the caller's idle time. A
+         *  default "since" means the wait was not timed.
+         ***********************************************************/
+        void addIdleTime(Clock::time_point since) {
+            if (since != Clock::time_point() && metricsEnabled()) {
+                callerStats().idle_ns.fetch_add(nanosSince(since, Clock::now()), std::memory_order_relaxed);
+            }
+        }
+
+        /***********************************************************
+         *  Execute a task, recording how long it waited in the queue
+         *  and how long it ran if metrics are enabled.
+         ***********************************************************/
+        void execute(Task& task) {
+            if (!metricsEnabled()) {
+                task.work();
+                return;
+            }
+            WorkerStats& stats = callerStats();
+            Clock::time_point start = Clock::now();
+            if (task.queued_at != Clock::time_point() && task.queued_at < start) {
+                stats.queue_wait.record(nanosSince(task.queued_at, start));
+            }
+            task.work();
+            std::uint64_t ran = nanosSince(start, Clock::now());
+            stats.execution.record(ran);
+            stats.busy_ns.fetch_add(ran, std::memory_order_relaxed);
+            stats.tasks_run.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        /***********************************************************
+         *  Add the metrics of one worker to the pool's totals and
+         *  return them.
+         ***********************************************************/
+        static WorkerMetrics collect(const WorkerStats& stats, ThreadPoolMetrics& totals) {
+            WorkerMetrics worker;
+            worker.tasks_run = stats.tasks_run.load(std::memory_order_relaxed);
+            worker.tasks_stolen = stats.tasks_stolen.load(std::memory_order_relaxed);
+            worker.busy_ns = stats.busy_ns.load(std::memory_order_relaxed);
+            worker.idle_ns = stats.idle_ns.load(std::memory_order_relaxed);
+            totals.tasks_run += worker.tasks_run;
+            totals.tasks_stolen += worker.tasks_stolen;
+            stats.queue_wait.snapshot(totals.queue_wait);
+            stats.execution.snapshot(totals.execution);
+            return worker;
+        }
+
+        /***********************************************************
+         *  Choose the queue for a task submitted without a node:
+         *  the caller's own node if it is a worker, otherwise the
+         *  nodes take turns.
+         ***********************************************************/
+        BlockingQueue<Task>& queueForSubmit() {
+            if (my_tasks.size() == 1) {
+                return *my_tasks[0];
+            }
+            int node = workerNode();
+            if (node < 0) {
+                node = static_cast<int>(next_node.fetch_add(1, std::memory_order_relaxed) % my_tasks.size());
+            }
+            return *my_tasks[node];
+        }
+
+        /***********************************************************
+         *  Get the queue of the given node.
+         ***********************************************************/
+        BlockingQueue<Task>& queueOfNode(int node) {
+            if (node < 0 || node >= static_cast<int>(my_tasks.size())) {
+                node = 0;
+            }
+            return *my_tasks[node];
+        }
+
+        /***********************************************************
+         *  Take a task from the shared queues without waiting,
+         *  starting with the given node.
+         ***********************************************************/
+        bool takeShared(Task& task, int node) {
+            int count = static_cast<int>(my_tasks.size());
+            for (int i = 0; i < count; ++i) {
+                if (my_tasks[(node + i) % count]->take(task, false)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        /***********************************************************
+         *  Get the number of tasks waiting in the shared queues.
+         ***********************************************************/
+        int sharedQueueSize() const {
+            int size = 0;
+            for (auto& queue : my_tasks) {
+                size += queue->getSize();
+            }
+            return size;
+        }
+
+        /***********************************************************
+         *  Pin the calling worker according to the placement.
+         ***********************************************************/
+        void placeWorker(int index, int node) {
+            if (my_placement == Placement::None) {
+                return;
+            }
+            const std::vector<int>& cpus = node_cpus[node];
+            int nodes = static_cast<int>(node_cpus.size());
+            pinCurrentThread(std::vector<int>{cpus[(index / nodes) % cpus.size()]});
+        }
+
+        /***********************************************************
+         *  Return true if the pool may grow and shrink.
+         ***********************************************************/
+        bool isElastic() const {
+            return max_threads.load(std::memory_order_relaxed) > min_threads.load(std::memory_order_relaxed);
+        }
+
+        std::chrono::milliseconds keepAlive() const {
+            return std::chrono::milliseconds(keep_alive_ms.load(std::memory_order_relaxed));
+        }
+
+        /***********************************************************
+         *  Execute a task. When the pool is elastic, also track how
+         *  many workers are busy and when a task was last started.
+         ***********************************************************/
+        void runTask(Task& task) {
+            bool track = isElastic();
+            if (track) {
+                busy_workers.fetch_add(1);
+                last_take.store(Clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+                maybeGrow();
+            }
+            execute(task);
+            if (track) {
+                busy_workers.fetch_sub(1);
+            }
+        }
 
         /***********************************************************
          *  Run the thread until the pool is shut down.
          *  Execute every task it takes from the task queue, waiting
-         *  if the task queue is empty.
+         *  if the task queue is empty. A worker that stays idle for
+         *  the keep-alive time retires if there are more than the
+         *  minimum number of workers.
+         ***********************************************************/
+        void run(Worker& self, int index) {
+            currentWorker() = WorkerContext{this, index, self.node, nullptr, self.stats.get()};
+            placeWorker(index, self.node);
+            BlockingQueue<Task>& queue = *my_tasks[self.node];
+            while (!shutdown) {
+                Task task;
+                Clock::time_point idle_since = metricsEnabled() ? Clock::now() : Clock::time_point();
+                bool taken = queue.tryTakeFor(task, keepAlive());
+                addIdleTime(idle_since);
+                if (taken) {
+                    runTask(task);
+                }
+                else if (!shutdown && tryRetire(self)) {
+                    break;
+                }
+            }
+            currentWorker() = WorkerContext();
+        }
+
+        /***********************************************************
+         *  Run the worker until the pool is shut down (work-stealing
+         *  mode). Look for a task in its own deque first, then in
+         *  the shared queue, then in other workers' deques, and
+         *  sleep only when there is no pending task anywhere.
          ***********************************************************/
-        void run() {
+        void runStealing(Worker& self, int index) {
+            currentWorker() = WorkerContext{this, index, self.node, self.local.get(), self.stats.get()};
+            placeWorker(index, self.node);
             while (!shutdown) {
                 Task task;
-                if (my_tasks.take(task)) {
-                    task();
+                if (findTask(task)) {
+                    runTask(task);
+                    continue;
+                }
+                Clock::time_point idle_since = metricsEnabled() ? Clock::now() : Clock::time_point();
+                bool woken = waitForWork();
+                addIdleTime(idle_since);
+                if (!woken && self.local->empty() && tryRetire(self)) {
+                    break;
+                }
+            }
+            currentWorker() = WorkerContext();
+        }
+
+        /***********************************************************
+         *  Sleep until a task is pending or the pool is shut down
+         *  (work-stealing mode). Return false if nothing happened
+         *  within the keep-alive time.
+         ***********************************************************/
+        bool waitForWork() {
+            std::unique_lock<std::mutex> lock(idle_mutex);
+            idle_workers.fetch_add(1);
+            bool woken = idle_cond.wait_for(lock, keepAlive(), [this] {
+                return shutdown || pending_tasks.load() > 0;
+            });
+            idle_workers.fetch_sub(1);
+            return woken;
+        }
+
+        /***********************************************************
+         *  Find a task without waiting (work-stealing mode). Look in
+         *  the caller's own deque if it is a worker, then in the
+         *  shared queues (its own node's first), then in other
+         *  workers' deques (on its own node first).
+         ***********************************************************/
+        bool findTask(Task& task) {
+            const WorkerContext& context = currentWorker();
+            LocalQueue* own = localQueue();
+            int node = own ? context.node : 0;
+            bool found = (own && own->pop(task)) || takeShared(task, node);
+            if (!found) {
+                std::shared_lock<std::shared_mutex> lock(workers_mutex);
+                int count = static_cast<int>(my_workers.size());
+                int first = own ? context.index + 1 : 0;
+                for (int pass = 0; !found && pass < 2; ++pass) {
+                    for (int i = 0; !found && i < count; ++i) {
+                        Worker& victim = *my_workers[(first + i) % count];
+                        if ((victim.node == node) == (pass == 0)) {
+                            found = victim.local.get() != own && victim.local->steal(task);
+                        }
+                    }
+                }
+                if (found && metricsEnabled()) {
+                    callerStats().tasks_stolen.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+            if (found) {
+                pending_tasks.fetch_sub(1);
+            }
+            return found;
+        }
+
+        /***********************************************************
+         *  Count newly queued tasks and wake up idle workers if
+         *  there are any (work-stealing mode). Both counters are
+         *  sequentially consistent, so either the idle worker sees
+         *  the task or we see the idle worker.
+         ***********************************************************/
+        void notifyTask(int count = 1) {
+            pending_tasks.fetch_add(count);
+            if (idle_workers.load() > 0) {
+                std::lock_guard<std::mutex> lock(idle_mutex);
+                if (count > 1) {
+                    idle_cond.notify_all();
+                }
+                else {
+                    idle_cond.notify_one();
+                }
+            }
+        }
+
+        static int laneOf(Priority priority) {
+            return static_cast<int>(priority);
+        }
+
+        /***********************************************************
+         *  Queue a task in work-stealing mode. Only Normal tasks go
+         *  to the caller's own deque, which has no lanes.
+         ***********************************************************/
+        void submitStealing(Task&& task, BlockingQueue<Task>& queue, Priority priority) {
+            LocalQueue* own = priority == Priority::Normal ? localQueue() : nullptr;
+            if (own) {
+                own->push(std::move(task));
+            }
+            else {
+                queue.put(std::move(task), laneOf(priority));
+            }
+            notifyTask();
+        }
+
+        /***********************************************************
+         *  Queue many tasks under a single lock acquisition of the
+         *  task queue. Used by the timer thread to hand out all the
+         *  timers that expired at once.
+         *
+         *  Whatever doesn't fit waits for room one task at a time,
+         *  like a normal submit.
+         ***********************************************************/
+        void submitBatch(std::vector<UniqueTask>& tasks) {
+            std::vector<Task> batch;
+            batch.reserve(tasks.size());
+            for (UniqueTask& task : tasks) {
+                batch.push_back(makeTask(std::move(task)));
+            }
+            BlockingQueue<Task>& queue = queueForSubmit();
+            auto next = batch.begin();
+            while (next != batch.end() && !shutdown) {
+                int added = queue.tryPutBatch(std::make_move_iterator(next), std::make_move_iterator(batch.end()),
+                                              laneOf(Priority::Normal));
+                next += added;
+                if (my_mode == Mode::WorkStealing && added > 0) {
+                    notifyTask(added);
+                }
+                if (next != batch.end()) {
+                    // The queue is full.
+                    if (my_mode == Mode::WorkStealing) {
+                        submitStealing(std::move(*next), queue, Priority::Normal);
+                    }
+                    else {
+                        queue.put(std::move(*next), laneOf(Priority::Normal));
+                    }
+                    ++next;
                 }
             }
+            maybeGrow();
+        }
+
+        /***********************************************************
+         *  Run the timer thread until the timers are stopped. Wake
+         *  up at the next deadline (or when an earlier timer is
+         *  added) and hand all expired tasks to the workers.
+         ***********************************************************/
+        void runTimers() {
+            std::vector<UniqueTask> due;
+            std::unique_lock<std::mutex> lock(timer_mutex);
+            while (!timers_stopped) {
+                my_timers.advance(Clock::now(), due);
+                if (!due.empty()) {
+                    lock.unlock();
+                    submitBatch(due);
+                    due.clear();
+                    lock.lock();
+                    continue;
+                }
+                timer_wake = my_timers.nextWake();
+                if (timer_wake == Clock::time_point::max()) {
+                    timer_cond.wait(lock);
+                }
+                else {
+                    timer_cond.wait_until(lock, timer_wake);
+                }
+            }
+        }
+
+        /***********************************************************
+         *  Add a timer, starting the timer thread if needed. Return
+         *  an invalid handle if the pool is shut down.
+         ***********************************************************/
+        TimerHandle addTimer(Clock::time_point deadline, UniqueTask&& task, Clock::duration period) {
+            std::lock_guard<std::mutex> lock(timer_mutex);
+            if (shutdown || timers_stopped) {
+                return TimerHandle();
+            }
+            if (!timer_thread.joinable()) {
+                timer_wake = Clock::time_point::max();
+                timer_thread = std::thread([this] {
+                    runTimers();
+                });
+            }
+            TimerHandle handle = my_timers.add(deadline, std::move(task), period);
+            if (deadline < timer_wake) {
+                timer_cond.notify_one();
+            }
+            return handle;
+        }
+
+        /***********************************************************
+         *  Stop the timer thread and drop all pending timers.
+         ***********************************************************/
+        void stopTimers() {
+            {
+                std::lock_guard<std::mutex> lock(timer_mutex);
+                timers_stopped = true;
+                timer_cond.notify_all();
+            }
+            if (timer_thread.joinable()) {
+                timer_thread.join();
+            }
+            std::lock_guard<std::mutex> lock(timer_mutex);
+            my_timers.clear();
+        }
+
+        /***********************************************************
+         *  Add a worker if the pool is elastic and below its maximum,
+         *  and the tasks that no idle worker is about to pick up are
+         *  too many or nothing has been started for too long. This
+         *  is checked whenever a task is submitted or started.
+         ***********************************************************/
+        void maybeGrow() {
+            if (!isElastic()) {
+                return;
+            }
+            int live = thread_count.load();
+            if (live >= max_threads.load()) {
+                return;
+            }
+            int depth = my_mode == Mode::WorkStealing ? pending_tasks.load() : sharedQueueSize();
+            int uncovered = depth - (live - busy_workers.load());
+            Clock::duration waited = Clock::now().time_since_epoch() - Clock::duration(last_take.load());
+            bool deep = uncovered >= grow_queue_depth.load();
+            bool stale = uncovered > 0 && waited >= std::chrono::milliseconds(grow_wait_ms.load());
+            if (deep || stale) {
+                std::unique_lock<std::shared_mutex> lock(workers_mutex);
+                if (!shutdown && thread_count.load() < max_threads.load()) {
+                    spawnWorker();
+                }
+            }
+        }
+
+        /***********************************************************
+         *  Retire the calling worker if there are more workers than
+         *  the minimum. Its slot is reused by the next new worker.
+         ***********************************************************/
+        bool tryRetire(Worker& self) {
+            int live = thread_count.load();
+            while (live > min_threads.load()) {
+                if (thread_count.compare_exchange_weak(live, live - 1)) {
+                    // Every node keeps at least one worker.
+                    std::atomic<int>& node_live = node_workers[self.node];
+                    int count = node_live.load();
+                    while (count > 1) {
+                        if (node_live.compare_exchange_weak(count, count - 1)) {
+                            self.retired = true;
+                            return true;
+                        }
+                    }
+                    thread_count.fetch_add(1);
+                    return false;
+                }
+            }
+            return false;
+        }
+
+        /***********************************************************
+         *  Start a new worker, reusing the slot of a retired worker
+         *  if there is one. "workers_mutex" must be held.
+         ***********************************************************/
+        void spawnWorker() {
+            int index = -1;
+            for (std::size_t i = 0; i < my_workers.size(); ++i) {
+                if (my_workers[i]->retired) {
+                    my_workers[i]->thread.join();
+                    my_workers[i]->retired = false;
+                    index = static_cast<int>(i);
+                    break;
+                }
+            }
+            if (index < 0) {
+                my_workers.push_back(std::unique_ptr<Worker>(new Worker()));
+                if (my_mode == Mode::WorkStealing) {
+                    my_workers.back()->local.reset(new LocalQueue());
+                }
+                index = static_cast<int>(my_workers.size()) - 1;
+            }
+            // Put the new worker on the node with the fewest workers.
+            Worker& worker = *my_workers[index];
+            worker.node = 0;
+            for (int node = 1; node < static_cast<int>(my_tasks.size()); ++node) {
+                if (node_workers[node].load() < node_workers[worker.node].load()) {
+                    worker.node = node;
+                }
+            }
+            node_workers[worker.node].fetch_add(1);
+            thread_count.fetch_add(1);
+            worker.thread = std::thread([this, &worker, index] {
+                if (my_mode == Mode::WorkStealing) {
+                    runStealing(worker, index);
+                }
+                else {
+                    run(worker, index);
+                }
+            });
         }
 
         /***********************************************************
          *  Create worker threads.
          ***********************************************************/
         void makeThreads(int thread_num) {
+            min_threads = thread_num;
+            max_threads = thread_num;
+            std::unique_lock<std::shared_mutex> lock(workers_mutex);
+            if (my_mode == Mode::WorkStealing) {
+                pending_tasks = sharedQueueSize();
+            }
             for (int i = 0; i < thread_num; ++i) {
-                my_threads.push_back(std::make_shared<std::thread>([this] {
-                    run();
-                }));
+                spawnWorker();
             }
         }
 
     public:
         /***********************************************************
-         *  Create a thread pool. Set the number of threads and max
-         *  tasks number.
+         *  Create a thread pool. Set the number of threads, max
+         *  tasks number (per node), how workers get their tasks and
+         *  where they run.
          ***********************************************************/
-        ThreadPool(int thread_num = std::thread::hardware_concurrency(), int maxTask = 100)
-        : my_tasks(maxTask), shutdown(false) {
+        ThreadPool(int thread_num = std::thread::hardware_concurrency(), int maxTask = 100,
+                   Mode mode = Mode::SharedQueue, Placement placement = Placement::None)
+        : shutdown(false), thread_count(0), my_mode(mode), my_placement(placement), next_node(0),
+          pending_tasks(0), idle_workers(0), min_threads(0), max_threads(0),
+          keep_alive_ms(60000), grow_queue_depth(1), grow_wait_ms(10), busy_workers(0),
+          last_take(Clock::now().time_since_epoch().count()), metrics_enabled(false),
+          timers_stopped(false), timer_wake(Clock::time_point::max()) {
+            if (placement == Placement::NumaNodes) {
+                // Every node needs at least one worker.
+                node_cpus = numaNodes();
+                node_cpus.resize(std::min<std::size_t>(node_cpus.size(), std::max(thread_num, 1)));
+            }
+            else if (placement == Placement::PinCores) {
+                node_cpus.push_back(availableCpus());
+            }
+            else {
+                node_cpus.push_back(std::vector<int>());
+            }
+            node_workers.reset(new std::atomic<int>[node_cpus.size()]);
+            for (std::size_t i = 0; i < node_cpus.size(); ++i) {
+                my_tasks.push_back(std::unique_ptr<BlockingQueue<Task>>(new BlockingQueue<Task>(maxTask)));
+                my_tasks.back()->setLanes({16, 4, 1});
+                node_workers[i] = 0;
+            }
             makeThreads(thread_num);
         }
 
@@ -59,29 +771,280 @@ namespace acht {
         }
 
         /***********************************************************
-         *  Submit task(lvalue) to the task queue.
+         *  Submit an already wrapped task to the task queue. Nothing
+         *  is allocated if the callable fits in the task.
+         ***********************************************************/
+        void submit(UniqueTask&& task) {
+            submit(Priority::Normal, std::move(task));
+        }
+
+        /***********************************************************
+         *  Submit an already wrapped task to the given lane.
+         ***********************************************************/
+        void submit(Priority priority, UniqueTask&& task) {
+            if (my_mode == Mode::WorkStealing) {
+                submitStealing(makeTask(std::move(task)), queueForSubmit(), priority);
+            }
+            else {
+                queueForSubmit().put(makeTask(std::move(task)), laneOf(priority));
+            }
+            maybeGrow();
+        }
+
+        /***********************************************************
+         *  Submit a task to the workers of the given NUMA node. In
+         *  work-stealing mode idle workers of other nodes may still
+         *  steal it. Without NumaNodes placement there is only node
+         *  0, and this is the same as submit().
+         ***********************************************************/
+        void submitToNode(int node, UniqueTask&& task) {
+            queueOfNode(node).put(makeTask(std::move(task)), laneOf(Priority::Normal));
+            if (my_mode == Mode::WorkStealing) {
+                notifyTask();
+            }
+            maybeGrow();
+        }
+
+        /***********************************************************
+         *  Submit a task without waiting. Return false, leaving the
+         *  task untouched, if the task queue is full.
+         ***********************************************************/
+        bool trySubmit(UniqueTask&& task) {
+            Task queued = makeTask(std::move(task));
+            bool added = true;
+            if (my_mode == Mode::WorkStealing) {
+                LocalQueue* own = localQueue();
+                if (own) {
+                    own->push(std::move(queued));
+                }
+                else {
+                    added = queueForSubmit().tryPutFor(std::move(queued), std::chrono::seconds(0),
+                                                       laneOf(Priority::Normal));
+                }
+                if (added) {
+                    notifyTask();
+                }
+            }
+            else {
+                added = queueForSubmit().tryPutFor(std::move(queued), std::chrono::seconds(0),
+                                                   laneOf(Priority::Normal));
+            }
+            if (!added) {
+                task = std::move(queued.work);
+                return false;
+            }
+            maybeGrow();
+            return true;
+        }
+
+        /***********************************************************
+         *  Run one queued task on the calling thread, if there is
+         *  any. Threads waiting for their own tasks call this to
+         *  help instead of sleeping. Return false if nothing ran.
+         ***********************************************************/
+        bool runPendingTask() {
+            Task task;
+            bool found = false;
+            if (my_mode == Mode::WorkStealing) {
+                found = findTask(task);
+            }
+            else {
+                found = takeShared(task, std::max(workerNode(), 0));
+            }
+            if (found) {
+                execute(task);
+            }
+            return found;
+        }
+
+        /***********************************************************
+         *  Submit "func(args...)" to the task queue and return a
+         *  future for its result. The callable and the arguments
+         *  are moved (or copied) into the task, so they may be
+         *  move-only. Exceptions are delivered through the future.
+         ***********************************************************/
+        template <typename F, typename... Args>
+        auto submit(F&& func, Args&&... args)
+        -> std::future<typename std::invoke_result<typename std::decay<F>::type,
+                                                   typename std::decay<Args>::type...>::type> {
+            return submit(Priority::Normal, std::forward<F>(func), std::forward<Args>(args)...);
+        }
+
+        /***********************************************************
+         *  The same as submit(func, args...), but queue the task in
+         *  the given lane.
+         ***********************************************************/
+        template <typename F, typename... Args>
+        auto submit(Priority priority, F&& func, Args&&... args)
+        -> std::future<typename std::invoke_result<typename std::decay<F>::type,
+                                                   typename std::decay<Args>::type...>::type> {
+            using Result = typename std::invoke_result<typename std::decay<F>::type,
+                                                       typename std::decay<Args>::type...>::type;
+            std::future<Result> result;
+            submit(priority, makeJob(result, std::forward<F>(func), std::forward<Args>(args)...));
+            return result;
+        }
+
+        /***********************************************************
+         *  The same as submit(func, args...), but run the task on
+         *  the workers of the given NUMA node.
+         ***********************************************************/
+        template <typename F, typename... Args>
+        auto submitToNode(int node, F&& func, Args&&... args)
+        -> std::future<typename std::invoke_result<typename std::decay<F>::type,
+                                                   typename std::decay<Args>::type...>::type> {
+            using Result = typename std::invoke_result<typename std::decay<F>::type,
+                                                       typename std::decay<Args>::type...>::type;
+            std::future<Result> result;
+            submitToNode(node, makeJob(result, std::forward<F>(func), std::forward<Args>(args)...));
+            return result;
+        }
+
+        /***********************************************************
+         *  Run "func" on the pool once "delay" has passed. The timer
+         *  has a resolution of 1 ms and never fires early. Return a
+         *  handle to cancel it.
          ***********************************************************/
-        void submit(const Task& task) {
-            my_tasks.put(task);
+        template <typename Rep, typename Period, typename F>
+        TimerHandle scheduleAfter(const std::chrono::duration<Rep, Period>& delay, F&& func) {
+            return scheduleAt(Clock::now() + std::chrono::duration_cast<Clock::duration>(delay),
+                              std::forward<F>(func));
         }
 
         /***********************************************************
-         *  Submit task(rvalue) to the task queue.
+         *  Run "func" on the pool at "deadline". Return a handle to
+         *  cancel it.
          ***********************************************************/
-        void submit(Task&& task) {
-            my_tasks.put(std::forward<Task>(task));
+        template <typename F>
+        TimerHandle scheduleAt(std::chrono::steady_clock::time_point deadline, F&& func) {
+            return addTimer(deadline, UniqueTask(std::forward<F>(func)), Clock::duration::zero());
         }
 
+        /***********************************************************
+         *  Run "func" on the pool every "period", starting one
+         *  period from now, until the timer is cancelled. If a run
+         *  has not finished when the next one is due, that next run
+         *  is skipped, so runs never overlap.
+         ***********************************************************/
+        template <typename Rep, typename Period, typename F>
+        TimerHandle scheduleEvery(const std::chrono::duration<Rep, Period>& period, F&& func) {
+            Clock::duration interval = std::chrono::duration_cast<Clock::duration>(period);
+            if (interval <= Clock::duration::zero()) {
+                return TimerHandle();
+            }
+            return addTimer(Clock::now() + interval, UniqueTask(std::forward<F>(func)), interval);
+        }
+
+        /***********************************************************
+         *  Cancel a timer. Return false if it has already fired or
+         *  was cancelled. A run that was already handed to the
+         *  workers still happens.
+         ***********************************************************/
+        bool cancel(TimerHandle handle) {
+            std::lock_guard<std::mutex> lock(timer_mutex);
+            return my_timers.cancel(handle);
+        }
+
+        /***********************************************************
+         *  Get the number of pending timers.
+         ***********************************************************/
+        int getTimerCount() {
+            std::lock_guard<std::mutex> lock(timer_mutex);
+            return my_timers.getSize();
+        }
+
+#if defined(__cpp_impl_coroutine)
+        /***********************************************************
+         *  An awaitable that resumes the awaiting coroutine on a
+         *  worker of the pool. The coroutine handle is queued
+         *  directly in a task, so a hop allocates nothing. If the
+         *  pool drops the task (it was shut down), the coroutine is
+         *  resumed where the task is destroyed, and the co_await
+         *  throws a broken_promise future_error.
+         ***********************************************************/
+        class ScheduleAwaitable {
+        private:
+            ThreadPool& my_pool;
+            bool dropped;
+
+            // Resumes the coroutine once, run or dropped.
+            class Resumer {
+            private:
+                ScheduleAwaitable* my_awaitable;
+                std::coroutine_handle<> my_handle;
+
+            public:
+                Resumer(ScheduleAwaitable* awaitable, std::coroutine_handle<> handle)
+                : my_awaitable(awaitable), my_handle(handle) {}
+
+                Resumer(Resumer&& other) noexcept
+                : my_awaitable(std::exchange(other.my_awaitable, nullptr)), my_handle(other.my_handle) {}
+
+                ~Resumer() {
+                    if (my_awaitable) {
+                        my_awaitable->dropped = true;
+                        my_handle.resume();
+                    }
+                }
+
+                // No copy
+                Resumer(const Resumer&) = delete;
+
+                // No assignment
+                Resumer& operator=(const Resumer&) = delete;
+                Resumer& operator=(Resumer&&) = delete;
+
+                void operator()() {
+                    my_awaitable = nullptr;
+                    my_handle.resume();
+                }
+            };
+
+        public:
+            explicit ScheduleAwaitable(ThreadPool& pool) : my_pool(pool), dropped(false) {}
+
+            bool await_ready() const noexcept {
+                return false;
+            }
+
+            // Nothing may touch the awaitable after the submit, the
+            // coroutine may already be running again.
+            void await_suspend(std::coroutine_handle<> handle) {
+                my_pool.submit(UniqueTask(Resumer(this, handle)));
+            }
+
+            void await_resume() const {
+                if (dropped) {
+                    throw std::future_error(std::future_errc::broken_promise);
+                }
+            }
+        };
+
+        /***********************************************************
+         *  Return an awaitable that moves the awaiting coroutine to
+         *  a worker of the pool: "co_await pool.schedule();".
+         ***********************************************************/
+        ScheduleAwaitable schedule() {
+            return ScheduleAwaitable(*this);
+        }
+#endif
+
         /***********************************************************
          *  If the pool was shut down, restart it.
          ***********************************************************/
         void start(int thread_num = std::thread::hardware_concurrency(), int maxTask = 100) {
             if (shutdown) {
                 shutdown = false;
-                makeThreads(thread_num);
+                {
+                    std::lock_guard<std::mutex> lock(timer_mutex);
+                    timers_stopped = false;
+                }
                 // Restart the task queue
-                my_tasks.start();
-                my_tasks.setMaxSize(maxTask);
+                for (auto& queue : my_tasks) {
+                    queue->start();
+                    queue->setMaxSize(maxTask);
+                }
+                makeThreads(thread_num);
             }
         }
 
@@ -93,15 +1056,36 @@ namespace acht {
                 shutdown = true;
 
                 // Stop the task queue
-                my_tasks.stop();
+                for (auto& queue : my_tasks) {
+                    queue->stop();
+                }
+
+                // Drop pending timers
+                stopTimers();
 
-                // Wait until submitted tasks are finish
-                for (auto thread : my_threads) {
-                    if (thread) {
-                        thread->join();
+                // Wake up idle workers
+                {
+                    std::lock_guard<std::mutex> lock(idle_mutex);
+                    idle_cond.notify_all();
+                }
+
+                // Wait until submitted tasks are finish. The workers may
+                // still look for tasks to steal, so join them without
+                // holding the lock.
+                std::vector<std::unique_ptr<Worker>> workers;
+                {
+                    std::unique_lock<std::shared_mutex> lock(workers_mutex);
+                    workers.swap(my_workers);
+                }
+                for (auto& worker : workers) {
+                    if (worker->thread.joinable()) {
+                        worker->thread.join();
                     }
                 }
-                my_threads.clear();
+                thread_count = 0;
+                for (std::size_t i = 0; i < my_tasks.size(); ++i) {
+                    node_workers[i] = 0;
+                }
             }
         }
 
@@ -109,7 +1093,128 @@ namespace acht {
          *  Set max tasks number.
          ***********************************************************/
         void setMaxTask(int maxTask) {
-            my_tasks.setMaxSize(maxTask);
+            for (auto& queue : my_tasks) {
+                queue->setMaxSize(maxTask);
+            }
+        }
+
+        /***********************************************************
+         *  Let the pool grow and shrink between "min" and "max"
+         *  workers. Workers are added when all of them are busy and
+         *  tasks queue up (see setGrowThreshold), and an idle worker
+         *  retires after the keep-alive time (see setKeepAlive) if
+         *  there are more than "min" workers. Missing workers are
+         *  started right away.
+         ***********************************************************/
+        void setThreadBounds(int min, int max) {
+            min = std::max(min, 0);
+            max = std::max(max, std::max(min, 1));
+            min_threads = min;
+            max_threads = max;
+            std::unique_lock<std::shared_mutex> lock(workers_mutex);
+            while (!shutdown && thread_count.load() < min) {
+                spawnWorker();
+            }
+        }
+
+        /***********************************************************
+         *  Set how many tasks of each lane workers take in turn
+         *  while all lanes have tasks waiting. Weights below 1 count
+         *  as 1; equal weights give plain round robin between lanes.
+         ***********************************************************/
+        void setPriorityWeights(int high, int normal, int low) {
+            for (auto& queue : my_tasks) {
+                queue->setLanes({high, normal, low});
+            }
+        }
+
+        /***********************************************************
+         *  Set how long a worker stays idle before it may retire.
+         ***********************************************************/
+        void setKeepAlive(std::chrono::milliseconds keep_alive) {
+            keep_alive_ms = keep_alive.count();
+        }
+
+        /***********************************************************
+         *  Set when an elastic pool adds a worker: at least "queued"
+         *  waiting tasks are not covered by idle workers, or no task
+         *  has been started for "waited" while such tasks wait. Both
+         *  are checked when a task is submitted or started.
+         ***********************************************************/
+        void setGrowThreshold(int queued, std::chrono::milliseconds waited) {
+            grow_queue_depth = std::max(queued, 1);
+            grow_wait_ms = waited.count();
+        }
+
+        /***********************************************************
+         *  Start or stop recording metrics: per-worker task counts,
+         *  busy and idle time, how long tasks waited in the queue
+         *  and ran, and the metrics of the task queues. Recording
+         *  is off by default; disabling keeps what was recorded.
+         ***********************************************************/
+        void setMetricsEnabled(bool enabled) {
+            metrics_enabled = enabled;
+            for (auto& queue : my_tasks) {
+                queue->setMetricsEnabled(enabled);
+            }
+        }
+
+        /***********************************************************
+         *  Forget all metrics recorded so far.
+         ***********************************************************/
+        void resetMetrics() {
+            {
+                std::shared_lock<std::shared_mutex> lock(workers_mutex);
+                for (auto& worker : my_workers) {
+                    worker->stats->reset();
+                }
+            }
+            helper_stats.reset();
+            for (auto& queue : my_tasks) {
+                queue->resetMetrics();
+            }
+        }
+
+        /***********************************************************
+         *  Take a snapshot of the metrics. The per-worker counters
+         *  are only summed up here, so this is the only place that
+         *  touches all of them.
+         ***********************************************************/
+        ThreadPoolMetrics getMetrics() {
+            ThreadPoolMetrics metrics;
+            metrics.queue_depth = my_mode == Mode::WorkStealing ? pending_tasks.load() : sharedQueueSize();
+            {
+                std::shared_lock<std::shared_mutex> lock(workers_mutex);
+                for (auto& worker : my_workers) {
+                    metrics.workers.push_back(collect(*worker->stats, metrics));
+                }
+            }
+            collect(helper_stats, metrics);
+            for (auto& queue : my_tasks) {
+                metrics.queue.merge(queue->getMetrics());
+            }
+            return metrics;
+        }
+
+        /***********************************************************
+         *  Get the number of worker threads.
+         ***********************************************************/
+        int getThreadCount() const {
+            return thread_count;
+        }
+
+        /***********************************************************
+         *  Get the number of nodes that tasks can be submitted to.
+         ***********************************************************/
+        int getNodeCount() const {
+            return static_cast<int>(my_tasks.size());
+        }
+
+        /***********************************************************
+         *  Get how workers get their tasks.
+         ***********************************************************/
+        Mode getMode() const {
+            return my_mode;
         }
     };
 
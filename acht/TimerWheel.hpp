@@ -0,0 +1,331 @@
+#ifndef _TIMER_WHEEL_HPP_
+#define _TIMER_WHEEL_HPP_
+
+#include "UniqueTask.hpp"
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <algorithm>
+
+namespace acht {
+
+    /***********************************************************
+     *  Identifies a timer so that it can be cancelled. A handle
+     *  stays safe to use after its timer fired or was cancelled:
+     *  the slot of a finished timer is reused with a new
+     *  generation, so a stale handle never matches a new timer.
+     ***********************************************************/
+    struct TimerHandle {
+        int index = -1;
+        std::uint32_t generation = 0;
+
+        // Return true if the handle refers to a timer at all.
+        bool isValid() const {
+            return index >= 0;
+        }
+    };
+
+    /***********************************************************
+     *  A hierarchical timer wheel: 4 levels of 64 slots, where a
+     *  slot of level L spans 64^L ticks. A timer is put into the
+     *  slot of the lowest level that reaches its expiry, and
+     *  timers of a higher level are moved down ("cascaded") when
+     *  the level below wraps around. Adding and cancelling are
+     *  O(1) and allocate nothing once the timer pool has grown.
+     *  Timers further away than 64^4 ticks (about 4.6 hours with
+     *  1 ms ticks) wait in the last slot range and are cascaded
+     *  again until they are in reach.
+     *
+     *  Deadlines are rounded up to whole ticks, so a timer never
+     *  fires early. The wheel is not thread-safe; its owner
+     *  serializes access.
+     ***********************************************************/
+    class TimerWheel {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+    private:
+        static constexpr int level_bits = 6;
+        static constexpr int slots = 1 << level_bits;
+        static constexpr int levels = 4;
+        static constexpr std::int64_t slot_mask = slots - 1;
+
+        // The state shared between a periodic timer and its runs.
+        struct Periodic {
+            UniqueTask work;
+            std::atomic<bool> running{false};
+        };
+
+        struct Timer {
+            UniqueTask work;
+            std::shared_ptr<Periodic> periodic;
+            Clock::time_point deadline;
+            Clock::duration period;
+            int prev = -1;
+            int next = -1;
+            int list = -1;
+            std::uint32_t generation = 0;
+        };
+
+        Clock::time_point origin;
+        Clock::duration my_tick;
+        // The last tick that was processed.
+        std::int64_t current;
+        std::vector<Timer> my_timers;
+        std::vector<int> free_timers;
+        std::vector<int> heads;
+        int active_count;
+
+        std::int64_t tickOf(Clock::time_point time, bool round_up) const {
+            Clock::duration since = time - origin;
+            if (since <= Clock::duration::zero()) {
+                return 0;
+            }
+            std::int64_t ticks = since / my_tick;
+            if (round_up && since % my_tick != Clock::duration::zero()) {
+                ++ticks;
+            }
+            return ticks;
+        }
+
+        void link(int index, int list) {
+            Timer& timer = my_timers[index];
+            timer.list = list;
+            timer.prev = -1;
+            timer.next = heads[list];
+            if (timer.next >= 0) {
+                my_timers[timer.next].prev = index;
+            }
+            heads[list] = index;
+        }
+
+        void unlink(int index) {
+            Timer& timer = my_timers[index];
+            if (timer.prev >= 0) {
+                my_timers[timer.prev].next = timer.next;
+            }
+            else {
+                heads[timer.list] = timer.next;
+            }
+            if (timer.next >= 0) {
+                my_timers[timer.next].prev = timer.prev;
+            }
+            timer.list = -1;
+        }
+
+        /***********************************************************
+         *  Put a timer into the slot matching its deadline, but not
+         *  before tick "earliest".
+         ***********************************************************/
+        void place(int index, std::int64_t earliest) {
+            std::int64_t expiry = std::max(tickOf(my_timers[index].deadline, true), earliest);
+            std::int64_t delta = expiry - current;
+            for (int level = 0; level < levels; ++level) {
+                if (delta < (std::int64_t(1) << (level_bits * (level + 1)))) {
+                    link(index, level * slots + static_cast<int>((expiry >> (level_bits * level)) & slot_mask));
+                    return;
+                }
+            }
+            // Out of reach: park it in the furthest slot for now.
+            int last = levels - 1;
+            std::int64_t furthest = current + (std::int64_t(1) << (level_bits * levels)) - 1;
+            link(index, last * slots + static_cast<int>((furthest >> (level_bits * last)) & slot_mask));
+        }
+
+        int allocate() {
+            if (free_timers.empty()) {
+                my_timers.emplace_back();
+                return static_cast<int>(my_timers.size()) - 1;
+            }
+            int index = free_timers.back();
+            free_timers.pop_back();
+            return index;
+        }
+
+        void release(int index) {
+            Timer& timer = my_timers[index];
+            timer.work.reset();
+            timer.periodic.reset();
+            ++timer.generation;
+            free_timers.push_back(index);
+            --active_count;
+        }
+
+        // Detach a whole slot list and return its first timer.
+        int detach(int list) {
+            int first = heads[list];
+            heads[list] = -1;
+            return first;
+        }
+
+        /***********************************************************
+         *  Move the timers of a higher level slot down.
+         ***********************************************************/
+        void cascade(int level, int slot) {
+            int index = detach(level * slots + slot);
+            // The current tick has not expired yet, its timers still may.
+            while (index >= 0) {
+                int next = my_timers[index].next;
+                place(index, current);
+                index = next;
+            }
+        }
+
+        /***********************************************************
+         *  Collect the tasks of the timers in the current slot of
+         *  the lowest level. Periodic timers are put back with
+         *  their next deadline; a run is skipped if the previous
+         *  one has not finished yet.
+         ***********************************************************/
+        void expire(Clock::time_point now, std::vector<UniqueTask>& due) {
+            int index = detach(static_cast<int>(current & slot_mask));
+            while (index >= 0) {
+                Timer& timer = my_timers[index];
+                int next = timer.next;
+                timer.list = -1;
+                if (!timer.periodic) {
+                    due.push_back(std::move(timer.work));
+                    release(index);
+                }
+                else {
+                    std::shared_ptr<Periodic> periodic = timer.periodic;
+                    if (!periodic->running.exchange(true)) {
+                        due.push_back(UniqueTask([periodic] {
+                            struct Done {
+                                Periodic& state;
+                                ~Done() {
+                                    state.running = false;
+                                }
+                            } done{*periodic};
+                            periodic->work();
+                        }));
+                    }
+                    // Fixed rate: skip the periods we fell behind.
+                    timer.deadline += timer.period;
+                    if (timer.deadline <= now) {
+                        timer.deadline += ((now - timer.deadline) / timer.period + 1) * timer.period;
+                    }
+                    place(index, current + 1);
+                }
+                index = next;
+            }
+        }
+
+    public:
+        explicit TimerWheel(Clock::duration tick = std::chrono::milliseconds(1))
+        : origin(Clock::now()), my_tick(std::max(tick, Clock::duration(1))), current(0),
+          heads(levels * slots, -1), active_count(0) {}
+
+        // No copy
+        TimerWheel(const TimerWheel&) = delete;
+
+        // No assignment
+        TimerWheel& operator=(const TimerWheel&) = delete;
+
+        /***********************************************************
+         *  Add a timer that hands out "task" at "deadline", or
+         *  every "period" from then on if the period is positive.
+         *  Periods shorter than a tick are rounded up to a tick.
+         ***********************************************************/
+        TimerHandle add(Clock::time_point deadline, UniqueTask&& task,
+                        Clock::duration period = Clock::duration::zero()) {
+            int index = allocate();
+            Timer& timer = my_timers[index];
+            timer.deadline = deadline;
+            timer.period = period;
+            if (period > Clock::duration::zero()) {
+                timer.period = std::max(period, my_tick);
+                timer.periodic = std::make_shared<Periodic>();
+                timer.periodic->work = std::move(task);
+            }
+            else {
+                timer.work = std::move(task);
+            }
+            ++active_count;
+            place(index, current + 1);
+            return TimerHandle{index, timer.generation};
+        }
+
+        /***********************************************************
+         *  Cancel a timer. Return false if it already fired (for a
+         *  one-shot timer) or was cancelled before. A run of a
+         *  periodic timer that was already handed out still runs.
+         ***********************************************************/
+        bool cancel(TimerHandle handle) {
+            if (handle.index < 0 || handle.index >= static_cast<int>(my_timers.size())) {
+                return false;
+            }
+            Timer& timer = my_timers[handle.index];
+            if (timer.generation != handle.generation || timer.list < 0) {
+                return false;
+            }
+            unlink(handle.index);
+            release(handle.index);
+            return true;
+        }
+
+        /***********************************************************
+         *  Process every tick up to "now" and append the tasks of
+         *  the timers that expired to "due".
+         ***********************************************************/
+        void advance(Clock::time_point now, std::vector<UniqueTask>& due) {
+            std::int64_t target = tickOf(now, false);
+            while (current < target) {
+                if (active_count == 0) {
+                    current = target;
+                    break;
+                }
+                ++current;
+                // Cascade each level whose lower level wrapped around.
+                for (int level = 1; level < levels; ++level) {
+                    if ((current & ((std::int64_t(1) << (level_bits * level)) - 1)) != 0) {
+                        break;
+                    }
+                    cascade(level, static_cast<int>((current >> (level_bits * level)) & slot_mask));
+                }
+                expire(now, due);
+            }
+        }
+
+        /***********************************************************
+         *  Get when advance() has to be called next: the deadline
+         *  of the nearest timer in the lowest level, or the next
+         *  time that level wraps around and needs timers cascaded.
+         *  Return Clock::time_point::max() if there are no timers.
+         ***********************************************************/
+        Clock::time_point nextWake() const {
+            if (active_count == 0) {
+                return Clock::time_point::max();
+            }
+            std::int64_t tick = current + 1;
+            for (; (tick & slot_mask) != 0; ++tick) {
+                if (heads[static_cast<int>(tick & slot_mask)] >= 0) {
+                    break;
+                }
+            }
+            return origin + tick * my_tick;
+        }
+
+        // Get the number of pending timers.
+        int getSize() const {
+            return active_count;
+        }
+
+        // Cancel all timers.
+        void clear() {
+            for (int list = 0; list < levels * slots; ++list) {
+                int index = detach(list);
+                while (index >= 0) {
+                    int next = my_timers[index].next;
+                    my_timers[index].list = -1;
+                    release(index);
+                    index = next;
+                }
+            }
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,126 @@
+#ifndef _TOPOLOGY_HPP_
+#define _TOPOLOGY_HPP_
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <algorithm>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace acht {
+
+    /***********************************************************
+     *  Parse a Linux CPU list such as "0-3,8,10-11".
+     ***********************************************************/
+    inline std::vector<int> parseCpuList(const std::string& list) {
+        std::vector<int> cpus;
+        std::stringstream list_stream(list);
+        std::string range;
+        while (std::getline(list_stream, range, ',')) {
+            if (range.empty() || range == "\n") {
+                continue;
+            }
+            std::size_t dash = range.find('-');
+            try {
+                int first = std::stoi(range.substr(0, dash));
+                int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+                for (int cpu = first; cpu <= last; ++cpu) {
+                    cpus.push_back(cpu);
+                }
+            }
+            catch (...) {
+                // Ignore malformed entries.
+            }
+        }
+        return cpus;
+    }
+
+    /***********************************************************
+     *  Get the CPUs this process may run on. On Linux this
+     *  respects taskset and cpuset restrictions.
+     ***********************************************************/
+    inline std::vector<int> availableCpus() {
+        std::vector<int> cpus;
+#if defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+            for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+                if (CPU_ISSET(cpu, &set)) {
+                    cpus.push_back(cpu);
+                }
+            }
+        }
+#endif
+        if (cpus.empty()) {
+            int count = std::max(1u, std::thread::hardware_concurrency());
+            for (int cpu = 0; cpu < count; ++cpu) {
+                cpus.push_back(cpu);
+            }
+        }
+        return cpus;
+    }
+
+    /***********************************************************
+     *  Get the available CPUs of every NUMA node, read from
+     *  /sys/devices/system/node. Nodes without available CPUs are
+     *  left out. If the topology can't be read (or on other
+     *  systems), all CPUs are reported as one node.
+     ***********************************************************/
+    inline std::vector<std::vector<int>> numaNodes() {
+        std::vector<int> available = availableCpus();
+        std::vector<std::vector<int>> nodes;
+#if defined(__linux__)
+        std::ifstream online_file("/sys/devices/system/node/online");
+        std::string online;
+        if (std::getline(online_file, online)) {
+            for (int node : parseCpuList(online)) {
+                std::ifstream cpu_file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+                std::string list;
+                std::getline(cpu_file, list);
+                std::vector<int> cpus;
+                for (int cpu : parseCpuList(list)) {
+                    if (std::find(available.begin(), available.end(), cpu) != available.end()) {
+                        cpus.push_back(cpu);
+                    }
+                }
+                if (!cpus.empty()) {
+                    nodes.push_back(cpus);
+                }
+            }
+        }
+#endif
+        if (nodes.empty()) {
+            nodes.push_back(available);
+        }
+        return nodes;
+    }
+
+    /***********************************************************
+     *  Restrict the calling thread to the given CPUs. Return
+     *  false if that is not supported or failed.
+     ***********************************************************/
+    inline bool pinCurrentThread(const std::vector<int>& cpus) {
+#if defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : cpus) {
+            if (cpu >= 0 && cpu < CPU_SETSIZE) {
+                CPU_SET(cpu, &set);
+            }
+        }
+        return !cpus.empty() && pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+        (void)cpus;
+        return false;
+#endif
+    }
+}
+
+#endif
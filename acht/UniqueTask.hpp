@@ -0,0 +1,164 @@
+#ifndef _UNIQUE_TASK_HPP_
+#define _UNIQUE_TASK_HPP_
+
+#include "MemoryPool.hpp"
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace acht {
+
+    /***********************************************************
+     *  A move-only "void()" callable, used for the tasks queued
+     *  in a ThreadPool.
+     *
+     *  Unlike std::function it accepts move-only callables (such
+     *  as lambdas owning a std::unique_ptr or a std::promise), and
+     *  it stores callables of up to "inline_size" bytes in place,
+     *  so the common case allocates nothing. Larger callables are
+     *  put in the MemoryPool.
+     ***********************************************************/
+    class UniqueTask {
+    public:
+        static constexpr std::size_t inline_size = 48;
+
+        UniqueTask() noexcept : my_ops(nullptr) {}
+
+        template <typename F,
+                  typename = typename std::enable_if<
+                      !std::is_same<typename std::decay<F>::type, UniqueTask>::value>::type>
+        UniqueTask(F&& func) : my_ops(nullptr) {
+            using Callable = typename std::decay<F>::type;
+            if constexpr (fitsInline<Callable>()) {
+                new (&my_storage) Callable(std::forward<F>(func));
+                my_ops = &InlineOps<Callable>::ops;
+            }
+            else {
+                PoolAllocator<Callable> allocator;
+                Callable* callable = allocator.allocate(1);
+                try {
+                    new (callable) Callable(std::forward<F>(func));
+                }
+                catch (...) {
+                    allocator.deallocate(callable, 1);
+                    throw;
+                }
+                new (&my_storage) Callable*(callable);
+                my_ops = &HeapOps<Callable>::ops;
+            }
+        }
+
+        UniqueTask(UniqueTask&& other) noexcept : my_ops(other.my_ops) {
+            if (my_ops) {
+                my_ops->move(&my_storage, &other.my_storage);
+                other.my_ops = nullptr;
+            }
+        }
+
+        UniqueTask& operator=(UniqueTask&& other) noexcept {
+            if (this != &other) {
+                reset();
+                my_ops = other.my_ops;
+                if (my_ops) {
+                    my_ops->move(&my_storage, &other.my_storage);
+                    other.my_ops = nullptr;
+                }
+            }
+            return *this;
+        }
+
+        // No copy
+        UniqueTask(const UniqueTask&) = delete;
+
+        // No assignment
+        UniqueTask& operator=(const UniqueTask&) = delete;
+
+        ~UniqueTask() {
+            reset();
+        }
+
+        /***********************************************************
+         *  Invoke the stored callable.
+         ***********************************************************/
+        void operator()() {
+            my_ops->invoke(&my_storage);
+        }
+
+        // Return true if a callable is stored.
+        explicit operator bool() const noexcept {
+            return my_ops != nullptr;
+        }
+
+        /***********************************************************
+         *  Destroy the stored callable, if any.
+         ***********************************************************/
+        void reset() noexcept {
+            if (my_ops) {
+                my_ops->destroy(&my_storage);
+                my_ops = nullptr;
+            }
+        }
+
+    private:
+        using Storage = typename std::aligned_storage<inline_size, alignof(std::max_align_t)>::type;
+
+        // Type-erased operations on the stored callable.
+        struct Ops {
+            void (*invoke)(void* storage);
+            void (*move)(void* dst, void* src) noexcept;
+            void (*destroy)(void* storage) noexcept;
+        };
+
+        template <typename Callable>
+        static constexpr bool fitsInline() {
+            return sizeof(Callable) <= inline_size
+                && alignof(std::max_align_t) % alignof(Callable) == 0
+                && std::is_nothrow_move_constructible<Callable>::value;
+        }
+
+        // The callable lives in the storage.
+        template <typename Callable>
+        struct InlineOps {
+            static Callable* get(void* storage) {
+                return std::launder(reinterpret_cast<Callable*>(storage));
+            }
+            static void invoke(void* storage) {
+                (*get(storage))();
+            }
+            static void move(void* dst, void* src) noexcept {
+                new (dst) Callable(std::move(*get(src)));
+                get(src)->~Callable();
+            }
+            static void destroy(void* storage) noexcept {
+                get(storage)->~Callable();
+            }
+            static constexpr Ops ops = {&invoke, &move, &destroy};
+        };
+
+        // The storage holds a pointer to the callable in the pool.
+        template <typename Callable>
+        struct HeapOps {
+            static Callable*& get(void* storage) {
+                return *std::launder(reinterpret_cast<Callable**>(storage));
+            }
+            static void invoke(void* storage) {
+                (*get(storage))();
+            }
+            static void move(void* dst, void* src) noexcept {
+                new (dst) Callable*(get(src));
+            }
+            static void destroy(void* storage) noexcept {
+                Callable* callable = get(storage);
+                callable->~Callable();
+                PoolAllocator<Callable>().deallocate(callable, 1);
+            }
+            static constexpr Ops ops = {&invoke, &move, &destroy};
+        };
+
+        Storage my_storage;
+        const Ops* my_ops;
+    };
+}
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef _WAIT_STRATEGY_HPP_
+#define _WAIT_STRATEGY_HPP_
+
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#endif
+
+namespace acht {
+
+    /***********************************************************
+     *  Tell the CPU that we are in a spin loop. This lowers the
+     *  power used by the loop and gives the sibling hyper-thread
+     *  more room to run.
+     ***********************************************************/
+    inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+        _mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+        asm volatile("yield" ::: "memory");
+#else
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+#endif
+    }
+
+    /***********************************************************
+     *  How a queue waits before it parks a thread on a condition
+     *  variable. The thread first checks the condition up to
+     *  "spin_count" times with a CPU pause in between, then up to
+     *  "yield_count" times giving up its time slice, and only then
+     *  goes to sleep.
+     *
+     *  The default strategy parks right away, which costs no CPU
+     *  while waiting. Spinning helps when the next item usually
+     *  arrives sooner than a futex sleep/wake round-trip.
+     ***********************************************************/
+    struct WaitStrategy {
+        int spin_count;
+        int yield_count;
+
+        WaitStrategy(int spins = 0, int yields = 0)
+        : spin_count(spins), yield_count(yields) {}
+
+        // Park right away.
+        static WaitStrategy park() {
+            return WaitStrategy(0, 0);
+        }
+
+        // Spin and yield for a while before parking.
+        static WaitStrategy adaptive() {
+            return WaitStrategy(1000, 20);
+        }
+
+        // Return true if this strategy waits at all before parking.
+        bool spins() const {
+            return spin_count > 0 || yield_count > 0;
+        }
+
+        /***********************************************************
+         *  Spin, then yield, until "ready" returns true. Return
+         *  false if we ran out of rounds and the caller should park.
+         ***********************************************************/
+        template <typename Predicate>
+        bool spinUntil(Predicate ready) const {
+            for (int i = 0; i < spin_count; ++i) {
+                if (ready()) {
+                    return true;
+                }
+                cpuRelax();
+            }
+            for (int i = 0; i < yield_count; ++i) {
+                if (ready()) {
+                    return true;
+                }
+                std::this_thread::yield();
+            }
+            return ready();
+        }
+    };
+
+    /***********************************************************
+     *  Turn a predicate into one that also holds once "deadline"
+     *  has passed, so that a timed wait never spins past it. A
+     *  deadline that has passed already ends the spin at once.
+     ***********************************************************/
+    template <typename Predicate, typename Clock, typename Duration>
+    auto untilDeadline(Predicate ready, const std::chrono::time_point<Clock, Duration>& deadline) {
+        return [ready, deadline] {
+            return ready() || Clock::now() >= deadline;
+        };
+    }
+}
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef _WORK_STEALING_QUEUE_HPP_
+#define _WORK_STEALING_QUEUE_HPP_
+
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <utility>
+#include "MemoryPool.hpp"
+
+namespace acht {
+
+    /***********************************************************
+     *  A double-ended queue owned by one worker thread.
+     *
+     *  The owner pushes and pops at the back (LIFO), so the task
+     *  it just forked runs next while its data is still in cache.
+     *  Other workers steal from the front (FIFO), which takes the
+     *  oldest and usually largest piece of work.
+     *
+     *  Each queue has its own lock. Only the owner uses it in the
+     *  common case, so the lock is almost never contended.
+     ***********************************************************/
+    template <typename T>
+    class WorkStealingQueue {
+    private:
+        std::deque<T, PoolAllocator<T>> my_deque;
+        mutable std::mutex my_mutex;
+        std::atomic<int> my_size;
+
+    public:
+        WorkStealingQueue() : my_size(0) {}
+
+        // No copy
+        WorkStealingQueue(const WorkStealingQueue&) = delete;
+
+        // No assignment
+        WorkStealingQueue& operator=(const WorkStealingQueue&) = delete;
+
+        /***********************************************************
+         *  Add the element at the back. Called by the owner.
+         ***********************************************************/
+        void push(T&& elem) {
+            std::lock_guard<std::mutex> lock(my_mutex);
+            my_deque.emplace_back(std::move(elem));
+            my_size.store(static_cast<int>(my_deque.size()), std::memory_order_relaxed);
+        }
+
+        /***********************************************************
+         *  Remove the newest element. Called by the owner.
+         ***********************************************************/
+        bool pop(T& elem) {
+            if (empty()) {
+                return false;
+            }
+            std::lock_guard<std::mutex> lock(my_mutex);
+            if (my_deque.empty()) {
+                return false;
+            }
+            elem = std::move(my_deque.back());
+            my_deque.pop_back();
+            my_size.store(static_cast<int>(my_deque.size()), std::memory_order_relaxed);
+            return true;
+        }
+
+        /***********************************************************
+         *  Remove the oldest element. Called by other workers.
+         ***********************************************************/
+        bool steal(T& elem) {
+            if (empty()) {
+                return false;
+            }
+            std::unique_lock<std::mutex> lock(my_mutex, std::try_to_lock);
+            if (!lock.owns_lock() || my_deque.empty()) {
+                // Someone else is working on this queue, try another.
+                return false;
+            }
+            elem = std::move(my_deque.front());
+            my_deque.pop_front();
+            my_size.store(static_cast<int>(my_deque.size()), std::memory_order_relaxed);
+            return true;
+        }
+
+        // Return true if the queue looks empty. It may be stale.
+        bool empty() const {
+            return my_size.load(std::memory_order_relaxed) == 0;
+        }
+
+        // Get the (approximate) size of queue
+        int getSize() const {
+            return my_size.load(std::memory_order_relaxed);
+        }
+
+        // Clear all the elements.
+        void clear() {
+            std::lock_guard<std::mutex> lock(my_mutex);
+            my_deque.clear();
+            my_size.store(0, std::memory_order_relaxed);
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,145 @@
+#ifndef _BENCH_UTIL_HPP_
+#define _BENCH_UTIL_HPP_
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+namespace bench {
+
+    using Clock = std::chrono::steady_clock;
+
+    /***********************************************************
+     *  The command line of a benchmark. "--quick" runs a small
+     *  version, e.g. as a smoke test.
+     ***********************************************************/
+    struct Options {
+        bool quick = false;
+
+        Options(int argc, char* argv[]) {
+            for (int i = 1; i < argc; ++i) {
+                if (std::strcmp(argv[i], "--quick") == 0) {
+                    quick = true;
+                }
+                else {
+                    std::fprintf(stderr, "usage: %s [--quick]\n", argv[0]);
+                }
+            }
+        }
+    };
+
+    inline std::uint64_t nowNanos() {
+        return static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count());
+    }
+
+    inline double secondsSince(Clock::time_point start) {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    /***********************************************************
+     *  Get the "p"th percentile (0 to 100) of some samples. The
+     *  samples are sorted.
+     ***********************************************************/
+    inline std::uint64_t percentile(std::vector<std::uint64_t>& samples, double p) {
+        if (samples.empty()) {
+            return 0;
+        }
+        if (!std::is_sorted(samples.begin(), samples.end())) {
+            std::sort(samples.begin(), samples.end());
+        }
+        std::size_t index = static_cast<std::size_t>(p / 100.0 * static_cast<double>(samples.size() - 1) + 0.5);
+        return samples[std::min(index, samples.size() - 1)];
+    }
+
+    /***********************************************************
+     *  Spin for about "nanos" nanoseconds, standing in for work.
+     ***********************************************************/
+    inline void spinFor(std::uint64_t nanos) {
+        if (nanos == 0) {
+            return;
+        }
+        std::uint64_t end = nowNanos() + nanos;
+        while (nowNanos() < end) {
+        }
+    }
+
+    /***********************************************************
+     *  One result, printed as a line of JSON, so that the output
+     *  of a run can be collected with e.g. "jq -s". Every line
+     *  names the benchmark and the case, then the parameters,
+     *  then the measurements.
+     ***********************************************************/
+    class Result {
+    private:
+        std::string my_line;
+
+        void key(const char* name) {
+            my_line += ",\"";
+            my_line += name;
+            my_line += "\":";
+        }
+
+    public:
+        Result(const char* benchmark, const std::string& name) {
+            my_line = "{\"benchmark\":\"";
+            my_line += benchmark;
+            my_line += "\",\"case\":\"";
+            my_line += name;
+            my_line += '"';
+        }
+
+        Result& add(const char* name, const std::string& value) {
+            key(name);
+            my_line += '"';
+            my_line += value;
+            my_line += '"';
+            return *this;
+        }
+
+        Result& add(const char* name, const char* value) {
+            return add(name, std::string(value));
+        }
+
+        Result& add(const char* name, double value) {
+            char number[32];
+            std::snprintf(number, sizeof(number), "%.6g", value);
+            key(name);
+            my_line += number;
+            return *this;
+        }
+
+        Result& add(const char* name, std::uint64_t value) {
+            key(name);
+            my_line += std::to_string(value);
+            return *this;
+        }
+
+        Result& add(const char* name, int value) {
+            key(name);
+            my_line += std::to_string(value);
+            return *this;
+        }
+
+        // Add the 50th, 99th and 99.9th percentile and the maximum of some latencies.
+        Result& addLatencies(const char* prefix, std::vector<std::uint64_t>& nanos) {
+            std::string name(prefix);
+            add((name + "_p50_ns").c_str(), percentile(nanos, 50));
+            add((name + "_p99_ns").c_str(), percentile(nanos, 99));
+            add((name + "_p999_ns").c_str(), percentile(nanos, 99.9));
+            add((name + "_max_ns").c_str(), nanos.empty() ? std::uint64_t(0) : nanos.back());
+            return *this;
+        }
+
+        void print() {
+            std::printf("%s}\n", my_line.c_str());
+            std::fflush(stdout);
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,107 @@
+/***********************************************************
+ *  Lines per second of the Logger and the latency a logging
+ *  thread sees per call, for several thread counts, text and
+ *  binary log files and two overflow policies. Lines per second
+ *  count until every record is in the file. The log files are
+ *  written to the current directory and removed afterwards.
+ ***********************************************************/
+
+#include "BenchUtil.hpp"
+#include "acht/Logger.hpp"
+#include <thread>
+#include <atomic>
+
+namespace {
+
+    using acht::Logger;
+
+    void run(int threads, bool binary, Logger::OverflowPolicy policy, int lines) {
+        const char* path = binary ? "logger_bench.blog" : "logger_bench.log";
+        std::remove(path);
+        auto logger = Logger::getLogger(Logger::Level::INFO);
+        if (binary) {
+            logger->setBinaryLogFile(path);
+        }
+        else {
+            logger->setLogFilePath(path);
+        }
+        logger->setOverflowPolicy(policy);
+
+        std::atomic<int> ready(0);
+        std::atomic<bool> go(false);
+        std::vector<std::vector<std::uint64_t>> latencies(threads);
+        std::vector<std::thread> workers;
+        int per_thread = lines / threads;
+        for (int t = 0; t < threads; ++t) {
+            workers.emplace_back([&, t] {
+                std::vector<std::uint64_t>& mine = latencies[t];
+                mine.reserve(per_thread);
+                ++ready;
+                while (!go) {
+                    std::this_thread::yield();
+                }
+                for (int i = 0; i < per_thread; ++i) {
+                    std::uint64_t before = bench::nowNanos();
+                    acht::LOG_INFO("request {} on thread {} took {} ms for {}", i, t, i * 0.5, "user@example.com");
+                    mine.push_back(bench::nowNanos() - before);
+                }
+            });
+        }
+        while (ready < threads) {
+            std::this_thread::yield();
+        }
+        auto start = bench::Clock::now();
+        go = true;
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        double calls_seconds = bench::secondsSince(start);
+        logger->stop();
+        double seconds = bench::secondsSince(start);
+        std::uint64_t dropped = logger->getDropCounts().getTotal();
+        logger.reset();
+        Logger::destroyLogger();
+
+        long bytes = 0;
+        if (std::FILE* file = std::fopen(path, "rb")) {
+            std::fseek(file, 0, SEEK_END);
+            bytes = std::ftell(file);
+            std::fclose(file);
+        }
+        std::remove(path);
+        std::remove("out.log");
+
+        std::vector<std::uint64_t> all;
+        for (auto& mine : latencies) {
+            all.insert(all.end(), mine.begin(), mine.end());
+        }
+        int total = per_thread * threads;
+        const char* policy_name = policy == Logger::OverflowPolicy::Block ? "Block" : "DropNewest";
+        const char* format = binary ? "binary" : "text";
+        bench::Result("logger", std::string(format) + "/" + policy_name + "/" + std::to_string(threads) + "t")
+            .add("format", format)
+            .add("policy", policy_name)
+            .add("threads", threads)
+            .add("lines", total)
+            .add("dropped", dropped)
+            .add("bytes", static_cast<std::uint64_t>(bytes))
+            .add("seconds", seconds)
+            .add("lines_per_sec", (total - dropped) / seconds)
+            .add("calls_per_sec", total / calls_seconds)
+            .addLatencies("call", all)
+            .print();
+    }
+}
+
+int main(int argc, char* argv[]) {
+    bench::Options options(argc, argv);
+    int lines = options.quick ? 20000 : 1000000;
+    for (bool binary : {false, true}) {
+        for (Logger::OverflowPolicy policy : {Logger::OverflowPolicy::Block, Logger::OverflowPolicy::DropNewest}) {
+            for (int threads : {1, 2, 4}) {
+                run(threads, binary, policy, lines);
+            }
+        }
+    }
+    return 0;
+}
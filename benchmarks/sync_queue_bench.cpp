@@ -0,0 +1,95 @@
+/***********************************************************
+ *  Throughput and latency of SyncQueue (and RingQueue, which
+ *  has the same interface) for several numbers of producers
+ *  and consumers and several capacities. Every element carries
+ *  the time it was put; consumers record how long it waited.
+ ***********************************************************/
+
+#include "BenchUtil.hpp"
+#include "acht/SyncQueue.hpp"
+#include "acht/RingQueue.hpp"
+#include <thread>
+#include <atomic>
+
+namespace {
+
+    template <typename Queue>
+    void run(const char* queue_name, int producers, int consumers, int capacity, int items) {
+        Queue queue(capacity);
+        std::atomic<int> ready(0);
+        std::atomic<bool> go(false);
+        std::vector<std::vector<std::uint64_t>> latencies(consumers);
+        std::vector<std::thread> threads;
+
+        int per_producer = items / producers;
+        int total = per_producer * producers;
+        for (int p = 0; p < producers; ++p) {
+            threads.emplace_back([&] {
+                ++ready;
+                while (!go) {
+                    std::this_thread::yield();
+                }
+                for (int i = 0; i < per_producer; ++i) {
+                    queue.put(bench::nowNanos());
+                }
+            });
+        }
+        // Consumers take until they have seen all elements between them.
+        std::atomic<int> taken(0);
+        for (int c = 0; c < consumers; ++c) {
+            threads.emplace_back([&, c] {
+                std::vector<std::uint64_t>& mine = latencies[c];
+                mine.reserve(total / consumers + 1);
+                ++ready;
+                while (!go) {
+                    std::this_thread::yield();
+                }
+                std::uint64_t stamp = 0;
+                while (taken.fetch_add(1) < total) {
+                    if (queue.take(stamp)) {
+                        mine.push_back(bench::nowNanos() - stamp);
+                    }
+                }
+            });
+        }
+        while (ready < producers + consumers) {
+            std::this_thread::yield();
+        }
+        auto start = bench::Clock::now();
+        go = true;
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        double seconds = bench::secondsSince(start);
+
+        std::vector<std::uint64_t> all;
+        for (auto& mine : latencies) {
+            all.insert(all.end(), mine.begin(), mine.end());
+        }
+        bench::Result("sync_queue", std::string(queue_name) + "/" + std::to_string(producers) + "p"
+                      + std::to_string(consumers) + "c/cap" + std::to_string(capacity))
+            .add("queue", queue_name)
+            .add("producers", producers)
+            .add("consumers", consumers)
+            .add("capacity", capacity)
+            .add("items", total)
+            .add("seconds", seconds)
+            .add("ops_per_sec", total / seconds)
+            .addLatencies("latency", all)
+            .print();
+    }
+}
+
+int main(int argc, char* argv[]) {
+    bench::Options options(argc, argv);
+    int items = options.quick ? 20000 : 1000000;
+    for (int capacity : {16, 1024}) {
+        for (int producers : {1, 2, 4}) {
+            for (int consumers : {1, 2, 4}) {
+                run<acht::SyncQueue<std::uint64_t>>("SyncQueue", producers, consumers, capacity, items);
+                run<acht::RingQueue<std::uint64_t>>("RingQueue", producers, consumers, capacity, items);
+            }
+        }
+    }
+    return 0;
+}
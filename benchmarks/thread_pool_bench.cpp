@@ -0,0 +1,100 @@
+/***********************************************************
+ *  Task overhead and scaling of ThreadPool with empty, short
+ *  (about 1 us) and long (about 100 us) tasks, for several
+ *  thread counts and both modes. "overhead_ns_per_task" is the
+ *  time the workers spent per task beyond the work itself.
+ *  The "future" cases submit through submit(func), which also
+ *  makes a future for every task.
+ ***********************************************************/
+
+#include "BenchUtil.hpp"
+#include "acht/ThreadPool.hpp"
+#include <thread>
+#include <atomic>
+#include <future>
+
+namespace {
+
+    using acht::ThreadPool;
+
+    struct TaskKind {
+        const char* name;
+        std::uint64_t work_ns;
+        int tasks;
+    };
+
+    void run(const TaskKind& kind, int threads, ThreadPool::Mode mode, bool futures, int tasks) {
+        ThreadPool pool(threads, 1024, mode);
+        std::atomic<int> done(0);
+        std::vector<std::future<void>> results;
+        if (futures) {
+            results.reserve(tasks);
+        }
+        std::uint64_t work_ns = kind.work_ns;
+
+        auto start = bench::Clock::now();
+        for (int i = 0; i < tasks; ++i) {
+            if (futures) {
+                results.push_back(pool.submit([work_ns] {
+                    bench::spinFor(work_ns);
+                }));
+            }
+            else {
+                pool.submit(acht::UniqueTask([work_ns, &done] {
+                    bench::spinFor(work_ns);
+                    done.fetch_add(1, std::memory_order_release);
+                }));
+            }
+        }
+        if (futures) {
+            for (auto& result : results) {
+                result.get();
+            }
+        }
+        else {
+            while (done.load(std::memory_order_acquire) < tasks) {
+                std::this_thread::yield();
+            }
+        }
+        double seconds = bench::secondsSince(start);
+
+        int cpus = std::max(1, std::min<int>(threads, std::thread::hardware_concurrency()));
+        double per_task = seconds * 1e9 * cpus / tasks;
+        const char* mode_name = mode == ThreadPool::Mode::WorkStealing ? "WorkStealing" : "SharedQueue";
+        bench::Result("thread_pool", std::string(kind.name) + (futures ? "+future" : "") + "/"
+                      + mode_name + "/" + std::to_string(threads) + "t")
+            .add("task", kind.name)
+            .add("mode", mode_name)
+            .add("threads", threads)
+            .add("futures", futures ? "yes" : "no")
+            .add("tasks", tasks)
+            .add("seconds", seconds)
+            .add("tasks_per_sec", tasks / seconds)
+            .add("overhead_ns_per_task", std::max(0.0, per_task - static_cast<double>(work_ns)))
+            .print();
+    }
+}
+
+int main(int argc, char* argv[]) {
+    bench::Options options(argc, argv);
+    int scale = options.quick ? 50 : 1;
+    TaskKind kinds[] = {
+        {"empty", 0, 1000000 / scale},
+        {"short", 1000, 200000 / scale},
+        {"long", 100000, 4000 / scale},
+    };
+    int hardware = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<int> thread_counts = {1, 2, 4};
+    if (hardware > 4) {
+        thread_counts.push_back(hardware);
+    }
+    for (const TaskKind& kind : kinds) {
+        for (ThreadPool::Mode mode : {ThreadPool::Mode::SharedQueue, ThreadPool::Mode::WorkStealing}) {
+            for (int threads : thread_counts) {
+                run(kind, threads, mode, false, kind.tasks);
+            }
+        }
+        run(kind, hardware, ThreadPool::Mode::SharedQueue, true, kind.tasks);
+    }
+    return 0;
+}
@@ -0,0 +1,56 @@
+#ifndef _STRESS_UTIL_HPP_
+#define _STRESS_UTIL_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <cstdio>
+#include <cstdlib>
+
+namespace stress {
+
+    inline std::atomic<int>& failures() {
+        static std::atomic<int> count(0);
+        return count;
+    }
+
+    /***********************************************************
+     *  Record a failed check. Checks go on after a failure, so
+     *  that one run shows all of them.
+     ***********************************************************/
+    inline void fail(const char* expression, const char* file, int line) {
+        ++failures();
+        std::fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expression);
+    }
+
+    /***********************************************************
+     *  Get the number of rounds to run: the first argument if
+     *  there is one, else "default_rounds".
+     ***********************************************************/
+    inline int rounds(int argc, char* argv[], int default_rounds) {
+        if (argc > 1) {
+            int count = std::atoi(argv[1]);
+            if (count > 0) {
+                return count;
+            }
+        }
+        return default_rounds;
+    }
+
+    inline void sleepMicros(int micros) {
+        std::this_thread::sleep_for(std::chrono::microseconds(micros));
+    }
+
+    // The exit code of a test.
+    inline int result() {
+        if (failures() != 0) {
+            std::fprintf(stderr, "%d checks failed\n", failures().load());
+            return 1;
+        }
+        return 0;
+    }
+}
+
+#define STRESS_CHECK(expression) ((expression) ? void() : stress::fail(#expression, __FILE__, __LINE__))
+
+#endif
@@ -0,0 +1,100 @@
+/***********************************************************
+ *  Smoke test of the C++20 coroutine support: tasks hop onto
+ *  a ThreadPool with schedule(), whenAll awaits many of them,
+ *  syncWait blocks on them from ordinary code, and exceptions
+ *  (including those for a shut down pool and for an empty
+ *  task) come through.
+ ***********************************************************/
+
+#include "StressUtil.hpp"
+#include "acht/Coroutine.hpp"
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <stdexcept>
+
+namespace {
+
+    using acht::ThreadPool;
+
+    acht::Task<int> square(ThreadPool& pool, int x, std::thread::id caller) {
+        co_await pool.schedule();
+        STRESS_CHECK(std::this_thread::get_id() != caller);
+        co_return x * x;
+    }
+
+    acht::Task<int> sumOfSquares(ThreadPool& pool, int count) {
+        std::vector<acht::Task<int>> tasks;
+        for (int i = 0; i < count; ++i) {
+            tasks.push_back(square(pool, i, std::this_thread::get_id()));
+        }
+        int sum = 0;
+        for (int value : co_await acht::whenAll(std::move(tasks))) {
+            sum += value;
+        }
+        co_return sum;
+    }
+
+    acht::Task<void> count(ThreadPool& pool, std::atomic<int>& counter) {
+        co_await pool.schedule();
+        ++counter;
+    }
+
+    acht::Task<int> failing(ThreadPool& pool) {
+        co_await pool.schedule();
+        throw std::runtime_error("coroutine failed");
+    }
+
+    void test(ThreadPool::Mode mode) {
+        ThreadPool pool(4, 100, mode);
+        STRESS_CHECK(acht::syncWait(square(pool, 7, std::this_thread::get_id())) == 49);
+        STRESS_CHECK(acht::syncWait(sumOfSquares(pool, 10)) == 285);
+        // More tasks than the task queue holds
+        STRESS_CHECK(acht::syncWait(sumOfSquares(pool, 1000)) == 332833500);
+
+        std::atomic<int> counter(0);
+        std::vector<acht::Task<void>> tasks;
+        for (int i = 0; i < 100; ++i) {
+            tasks.push_back(count(pool, counter));
+        }
+        acht::syncWait(acht::whenAll(std::move(tasks)));
+        STRESS_CHECK(counter == 100);
+
+        bool thrown = false;
+        try {
+            acht::syncWait(failing(pool));
+        }
+        catch (const std::runtime_error&) {
+            thrown = true;
+        }
+        STRESS_CHECK(thrown);
+
+        acht::Task<int> task = square(pool, 3, std::this_thread::get_id());
+        acht::Task<int> moved = std::move(task);
+        bool empty = false;
+        try {
+            acht::syncWait(task);
+        }
+        catch (const std::future_error& error) {
+            empty = error.code() == std::future_errc::no_state;
+        }
+        STRESS_CHECK(empty);
+        STRESS_CHECK(acht::syncWait(moved) == 9);
+
+        pool.shutdownNow();
+        bool broken = false;
+        try {
+            acht::syncWait(square(pool, 2, std::this_thread::get_id()));
+        }
+        catch (const std::future_error& error) {
+            broken = error.code() == std::future_errc::broken_promise;
+        }
+        STRESS_CHECK(broken);
+    }
+}
+
+int main() {
+    test(ThreadPool::Mode::SharedQueue);
+    test(ThreadPool::Mode::WorkStealing);
+    return stress::result();
+}
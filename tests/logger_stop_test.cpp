@@ -0,0 +1,328 @@
+/***********************************************************
+ *  Stress test of stop() and start() on Logger. First threads
+ *  keep logging while the logger is stopped and restarted,
+ *  switched between text and binary log files, given other
+ *  overflow policies and sinks; nothing may hang or crash and
+ *  the files must stay well formed. Then threads log on a
+ *  quiet logger, and every line must be in the file and in a
+ *  sink exactly once. Last, literal messages must be logged
+ *  without any allocation on the calling thread, braces in a
+ *  lone message must be kept, a binary log file whose last
+ *  record was cut short must take new records, and arguments
+ *  of an unknown type must mark a record as corrupt. Meant to
+ *  be run under ThreadSanitizer and AddressSanitizer as well.
+ *  The log files are written to the current directory and
+ *  removed afterwards.
+ ***********************************************************/
+
+#include "StressUtil.hpp"
+#include "acht/Logger.hpp"
+#include "acht/BinaryLog.hpp"
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <new>
+
+// Counts the allocations of each thread.
+thread_local long allocations = 0;
+
+void* operator new(std::size_t size) {
+    ++allocations;
+    if (void* pointer = std::malloc(size == 0 ? 1 : size)) {
+        return pointer;
+    }
+    throw std::bad_alloc();
+}
+
+// GCC takes the malloc() above for the built-in new when these are inlined.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void operator delete(void* pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept {
+    std::free(pointer);
+}
+
+namespace {
+
+    using acht::Logger;
+
+    const int loggers = 3;
+    const char* text_paths[] = {"logger_stop_test_a.log", "logger_stop_test_b.log"};
+    const char* binary_path = "logger_stop_test.blog";
+    const char* clean_path = "logger_stop_test_clean.log";
+    const char* literal_path = "logger_stop_test_literal.log";
+    const char* torn_path = "logger_stop_test_torn.blog";
+
+    /***********************************************************
+     *  Counts the lines of the clean phase that it gets.
+     ***********************************************************/
+    class CountingSink : public acht::LogSink {
+    private:
+        std::atomic<long> my_lines;
+
+    protected:
+        void writeText(const char* data, std::size_t size) override {
+            std::string text(data, size);
+            for (std::size_t pos = text.find("clean "); pos != std::string::npos; pos = text.find("clean ", pos + 1)) {
+                ++my_lines;
+            }
+        }
+
+    public:
+        CountingSink() : my_lines(0) {}
+
+        long getLines() const {
+            return my_lines;
+        }
+    };
+
+    std::string readFile(const char* path) {
+        std::ifstream file(path, std::ios::binary);
+        std::stringstream contents;
+        contents << file.rdbuf();
+        return contents.str();
+    }
+
+    // Every line of a text log file is whole and has a level.
+    void checkTextFile(const char* path) {
+        std::string contents = readFile(path);
+        STRESS_CHECK(contents.empty() || contents.back() == '\n');
+        std::istringstream lines(contents);
+        std::string line;
+        while (std::getline(lines, line)) {
+            STRESS_CHECK(line.find(" [") != std::string::npos);
+        }
+    }
+
+    // Every record of a binary log file decodes.
+    void checkBinaryFile(const char* path) {
+        std::string contents = readFile(path);
+        acht::BinaryLogDecoder decoder;
+        decoder.feed(contents.data(), contents.size());
+        acht::BinaryLogDecoder::Record record;
+        acht::BinaryLogDecoder::Status status;
+        while ((status = decoder.next(record)) == acht::BinaryLogDecoder::Status::Record) {
+        }
+        STRESS_CHECK(status == acht::BinaryLogDecoder::Status::NeedMore);
+        STRESS_CHECK(!decoder.hasPartialEntry());
+    }
+
+    void removeFiles() {
+        for (const char* path : text_paths) {
+            std::remove(path);
+        }
+        std::remove(binary_path);
+        std::remove(clean_path);
+        std::remove(literal_path);
+        std::remove(torn_path);
+        // The file the logger opens when it is created
+        std::remove("out.log");
+    }
+
+    void chaos(Logger& logger, int rounds) {
+        std::atomic<bool> done(false);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < loggers; ++t) {
+            threads.emplace_back([&, t] {
+                for (long i = 0; !done; ++i) {
+                    acht::LOG_INFO("chaos {} {} {}", t, i, "some text to format");
+                    if (i % 64 == 0) {
+                        acht::LOG_ERROR("chaos error {} {}", t, i);
+                    }
+                }
+            });
+        }
+
+        auto ring = std::make_shared<acht::MemoryRingSink>(4096);
+        auto async = std::make_shared<acht::AsyncLogSink>(std::make_shared<CountingSink>(), 4);
+        for (int i = 0; i < rounds; ++i) {
+            stress::sleepMicros(200 + (i * 7919) % 2000);
+            switch (i % 6) {
+                case 0:
+                    logger.stop();
+                    stress::sleepMicros(100);
+                    logger.start();
+                    break;
+                case 1:
+                    logger.setLogFilePath(text_paths[i / 6 % 2]);
+                    break;
+                case 2:
+                    logger.setBinaryLogFile(binary_path);
+                    break;
+                case 3:
+                    logger.addSink(ring);
+                    logger.addSink(async);
+                    break;
+                case 4:
+                    logger.setOverflowPolicy(i / 6 % 2 == 0 ? Logger::OverflowPolicy::DropNewest
+                                                            : Logger::OverflowPolicy::DropOldest);
+                    logger.removeSink(ring);
+                    break;
+                default:
+                    logger.setOverflowPolicy(Logger::OverflowPolicy::Block);
+                    logger.removeSink(async);
+                    break;
+            }
+        }
+        done = true;
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        logger.removeSink(ring);
+        logger.removeSink(async);
+        logger.stop();
+        ring->getContents();
+
+        for (const char* path : text_paths) {
+            checkTextFile(path);
+        }
+        checkBinaryFile(binary_path);
+    }
+
+    void clean(Logger& logger, int lines) {
+        logger.setOverflowPolicy(Logger::OverflowPolicy::Block);
+        logger.setLogFilePath(clean_path);
+        auto sink = std::make_shared<CountingSink>();
+        logger.addSink(sink);
+        logger.start();
+
+        std::vector<std::thread> threads;
+        for (int t = 0; t < loggers; ++t) {
+            threads.emplace_back([t, lines] {
+                for (int i = 0; i < lines; ++i) {
+                    acht::LOG_INFO("clean {} {}", t, i);
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        logger.stop();
+        logger.removeSink(sink);
+        STRESS_CHECK(sink->getLines() == static_cast<long>(loggers) * lines);
+
+        // Each line once; drops of the first phase may be reported, too.
+        std::vector<std::vector<int>> seen(loggers, std::vector<int>(lines, 0));
+        std::istringstream file(readFile(clean_path));
+        std::string line;
+        long count = 0;
+        while (std::getline(file, line)) {
+            std::size_t pos = line.find("[INFO] clean ");
+            if (pos == std::string::npos) {
+                STRESS_CHECK(line.find("log records dropped") != std::string::npos);
+                continue;
+            }
+            int t = -1;
+            int i = -1;
+            std::sscanf(line.c_str() + pos, "[INFO] clean %d %d", &t, &i);
+            STRESS_CHECK(t >= 0 && t < loggers && i >= 0 && i < lines);
+            if (t >= 0 && t < loggers && i >= 0 && i < lines) {
+                ++seen[t][i];
+            }
+            ++count;
+        }
+        STRESS_CHECK(count == static_cast<long>(loggers) * lines);
+        for (auto& counts : seen) {
+            for (int times : counts) {
+                STRESS_CHECK(times == 1);
+            }
+        }
+    }
+
+    void literals(Logger& logger, int lines) {
+        logger.setLogFilePath(literal_path);
+        logger.start();
+        // The first records set up the buffer of this thread.
+        acht::LOG_INFO("warm up");
+        acht::LOG_INFO("warm up {}", 0);
+        long before = allocations;
+        for (int i = 0; i < lines; ++i) {
+            acht::LOG_INFO("lone {} literal, longer than a short string");
+            acht::LOG_INFO("literal {} with argument", i);
+        }
+        STRESS_CHECK(allocations == before);
+        logger.stop();
+
+        long lone = 0;
+        long formatted = 0;
+        std::istringstream file(readFile(literal_path));
+        std::string line;
+        while (std::getline(file, line)) {
+            lone += line.find("[INFO] lone {} literal, longer than a short string") != std::string::npos;
+            formatted += line.find("{}") == std::string::npos && line.find(" with argument") != std::string::npos;
+        }
+        STRESS_CHECK(lone == lines);
+        STRESS_CHECK(formatted == lines);
+    }
+
+    void torn(Logger& logger, int records) {
+        for (const char* when : {"before", "after"}) {
+            logger.setBinaryLogFile(torn_path);
+            logger.start();
+            for (int i = 0; i < records; ++i) {
+                acht::LOG_INFO("torn {} {}", i, when);
+            }
+            logger.stop();
+            if (std::string(when) == "before") {
+                // Cut the last record short, as a crash while writing it would.
+                std::string contents = readFile(torn_path);
+                contents.resize(contents.size() - 3);
+                std::ofstream(torn_path, std::ios::binary | std::ios::trunc) << contents;
+            }
+        }
+
+        std::string contents = readFile(torn_path);
+        acht::BinaryLogDecoder decoder;
+        decoder.feed(contents.data(), contents.size());
+        acht::BinaryLogDecoder::Record record;
+        acht::BinaryLogDecoder::Status status;
+        long count = 0;
+        while ((status = decoder.next(record)) == acht::BinaryLogDecoder::Status::Record) {
+            count += std::string(record.format) == "torn {} {}";
+        }
+        STRESS_CHECK(status == acht::BinaryLogDecoder::Status::NeedMore);
+        STRESS_CHECK(!decoder.hasPartialEntry());
+        STRESS_CHECK(count == 2L * records - 1);
+    }
+
+    // Arguments of a type the format does not know must not be dropped unnoticed.
+    void unknownArgument() {
+        char args[1 + sizeof(std::int64_t) + 2];
+        char* out = args;
+        *out++ = static_cast<char>(acht::LogArgType::Int);
+        acht::detail::putRaw(out, static_cast<std::int64_t>(42));
+        *out++ = static_cast<char>(0x7f);
+        *out++ = 'x';
+        std::string compacted;
+        acht::detail::compactArgs(compacted, args, sizeof(args));
+        std::string expanded;
+        STRESS_CHECK(!acht::detail::expandArgs(expanded, compacted.data(), compacted.data() + compacted.size()));
+    }
+}
+
+int main(int argc, char* argv[]) {
+    int rounds = stress::rounds(argc, argv, 60);
+    removeFiles();
+    auto logger = Logger::getLogger(Logger::Level::INFO);
+    logger->setBufferCapacity(64);
+    chaos(*logger, rounds);
+    std::printf("chaos: %d rounds, %llu records dropped\n", rounds,
+                static_cast<unsigned long long>(logger->getDropCounts().getTotal()));
+    clean(*logger, 5000);
+    std::printf("clean: %d lines\n", loggers * 5000);
+    literals(*logger, 1000);
+    torn(*logger, 100);
+    unknownArgument();
+    logger.reset();
+    Logger::destroyLogger();
+    removeFiles();
+    return stress::result();
+}
@@ -0,0 +1,178 @@
+/***********************************************************
+ *  Stress test of stop() and start() on SyncQueue and
+ *  RingQueue: producers and consumers hammer a small queue
+ *  with every kind of put and take while the queue is stopped
+ *  and restarted under them. Every thread must return once
+ *  the queue is stopped, and no element may be lost or taken
+ *  twice. Producers spread their elements over three lanes.
+ *  Meant to be run under ThreadSanitizer and AddressSanitizer
+ *  as well.
+ ***********************************************************/
+
+#include "StressUtil.hpp"
+#include "acht/SyncQueue.hpp"
+#include "acht/RingQueue.hpp"
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <chrono>
+
+namespace {
+
+    const int producers = 3;
+    const int consumers = 3;
+
+    template <typename Queue>
+    void round(Queue& queue, int seed) {
+        std::atomic<bool> stopped(false);
+        std::atomic<long> put_sum(0);
+        std::atomic<long> put_count(0);
+        std::atomic<long> take_sum(0);
+        std::atomic<long> take_count(0);
+        std::vector<std::thread> threads;
+
+        for (int p = 0; p < producers; ++p) {
+            threads.emplace_back([&, p] {
+                long value = p * 1000000L;
+                std::vector<long> batch;
+                while (!stopped) {
+                    ++value;
+                    bool added = false;
+                    int lane = static_cast<int>(value / 3 % 3);
+                    switch (value % 3) {
+                        case 0:
+                            added = queue.tryPutFor(value, std::chrono::microseconds(100), lane);
+                            break;
+                        case 1:
+                            added = queue.tryPutFor(value, std::chrono::seconds(0), lane);
+                            break;
+                        default:
+                            batch.assign(1, value);
+                            added = queue.tryPutBatch(batch.begin(), batch.end(), lane) == 1;
+                            break;
+                    }
+                    if (added) {
+                        put_sum += value;
+                        ++put_count;
+                    }
+                }
+            });
+        }
+        // Blocking takes return false once the queue is stopped, the
+        // timed one keeps polling until the producers are done.
+        for (int c = 0; c < consumers; ++c) {
+            threads.emplace_back([&, c] {
+                long value;
+                std::vector<long> batch;
+                while (true) {
+                    batch.clear();
+                    if (c == 0) {
+                        if (!queue.take(value)) {
+                            return;
+                        }
+                        batch.push_back(value);
+                    }
+                    else if (c == 1) {
+                        if (!queue.takeBatch(batch, 8)) {
+                            return;
+                        }
+                    }
+                    else if (queue.tryTakeFor(value, std::chrono::milliseconds(1))) {
+                        batch.push_back(value);
+                    }
+                    else if (stopped) {
+                        return;
+                    }
+                    for (long taken : batch) {
+                        take_sum += taken;
+                        ++take_count;
+                    }
+                }
+            });
+        }
+
+        stress::sleepMicros(200 + seed % 2000);
+        queue.stop();
+        stopped = true;
+        for (auto& thread : threads) {
+            thread.join();
+        }
+
+        // What was put and not taken is still in the queue.
+        queue.start();
+        long value;
+        while (queue.take(value, false)) {
+            take_sum += value;
+            ++take_count;
+        }
+        STRESS_CHECK(take_count == put_count);
+        STRESS_CHECK(take_sum == put_sum);
+    }
+
+    // A batch of nothing is refused at once, even from a queue that has elements.
+    template <typename Queue>
+    void emptyBatch(Queue& queue) {
+        long value = 1;
+        queue.put(value);
+        std::vector<long> batch(1);
+        STRESS_CHECK(!queue.takeBatch(batch, 0));
+        STRESS_CHECK(!queue.takeBatch(batch, -1, false));
+        STRESS_CHECK(!queue.tryTakeBatchFor(batch, 0, std::chrono::milliseconds(1)));
+        STRESS_CHECK(batch.empty());
+        STRESS_CHECK(queue.takeBatch(batch, 1) && batch.size() == 1);
+    }
+
+    // Elements keep their order within a lane, and every lane gets its turn.
+    template <typename Queue>
+    void lanes(Queue& queue) {
+        queue.setLanes({4, 2, 1});
+        for (long value = 0; value < 12; ++value) {
+            queue.put(value, static_cast<int>(value % 3));
+        }
+        long last[3] = {-1, -1, -1};
+        long value;
+        for (int i = 0; i < 12; ++i) {
+            STRESS_CHECK(queue.take(value, false));
+            STRESS_CHECK(value > last[value % 3]);
+            last[value % 3] = value;
+        }
+        STRESS_CHECK(!queue.take(value, false));
+        STRESS_CHECK(last[0] == 9 && last[1] == 10 && last[2] == 11);
+    }
+
+    // A queue holding more than a lowered max size is full.
+    template <typename Queue>
+    void shrunk(Queue& queue) {
+        for (long value = 0; value < 4; ++value) {
+            queue.put(value);
+        }
+        queue.setMaxSize(2);
+        STRESS_CHECK(queue.isFull());
+        queue.clear();
+        STRESS_CHECK(!queue.isFull());
+        queue.setMaxSize(16);
+    }
+
+    template <typename Queue>
+    void test(const char* name, int rounds) {
+        Queue queue(16);
+        emptyBatch(queue);
+        lanes(queue);
+        shrunk(queue);
+        queue.setMetricsEnabled(true);
+        for (int i = 0; i < rounds; ++i) {
+            round(queue, i * 7919);
+        }
+        // Every element put in the rounds was taken again.
+        acht::QueueMetrics metrics = queue.getMetrics();
+        STRESS_CHECK(metrics.puts > 0 && metrics.puts == metrics.takes);
+        std::printf("%s: %d rounds\n", name, rounds);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    int rounds = stress::rounds(argc, argv, 50);
+    test<acht::SyncQueue<long>>("SyncQueue", rounds);
+    test<acht::RingQueue<long>>("RingQueue", rounds);
+    return stress::result();
+}
@@ -0,0 +1,168 @@
+/***********************************************************
+ *  Tests of TaskGraph and TaskGroup on a ThreadPool in both
+ *  modes: tasks run after everything they depend on and
+ *  exactly once per run, a failing task skips its dependents,
+ *  bad graphs are rejected, and a shut down pool reports the
+ *  tasks it dropped instead of hanging.
+ ***********************************************************/
+
+#include "StressUtil.hpp"
+#include "acht/TaskGraph.hpp"
+#include <atomic>
+#include <vector>
+#include <stdexcept>
+
+namespace {
+
+    using acht::ThreadPool;
+    using acht::TaskGraph;
+
+    void testOrder(ThreadPool& pool) {
+        // Layers of tasks, each depending on every task of the layer before.
+        const int layers = 5;
+        const int width = 8;
+        std::vector<std::atomic<int>> runs(layers * width);
+        TaskGraph graph;
+        for (int layer = 0; layer < layers; ++layer) {
+            for (int i = 0; i < width; ++i) {
+                int id = graph.addTask([&runs, layer, i] {
+                    int round = runs[layer * width + i].load();
+                    for (int before = 0; layer > 0 && before < width; ++before) {
+                        STRESS_CHECK(runs[(layer - 1) * width + before].load() == round + 1);
+                    }
+                    ++runs[layer * width + i];
+                });
+                for (int before = 0; layer > 0 && before < width; ++before) {
+                    graph.addDependency((layer - 1) * width + before, id);
+                }
+            }
+        }
+        STRESS_CHECK(graph.getTaskCount() == layers * width);
+        const int rounds = 50;
+        for (int round = 0; round < rounds; ++round) {
+            graph.run(pool);
+        }
+        for (auto& count : runs) {
+            STRESS_CHECK(count == rounds);
+        }
+    }
+
+    void testFailure(ThreadPool& pool) {
+        std::atomic<int> skipped(0);
+        std::atomic<int> independent(0);
+        TaskGraph graph;
+        int bad = graph.addTask([] {
+            throw std::runtime_error("task failed");
+        });
+        int after = graph.addTask([&skipped] {
+            ++skipped;
+        }, {bad});
+        graph.addTask([&skipped] {
+            ++skipped;
+        }, {after});
+        graph.addTask([&independent] {
+            ++independent;
+        });
+        bool thrown = false;
+        try {
+            graph.run(pool);
+        }
+        catch (const std::runtime_error&) {
+            thrown = true;
+        }
+        STRESS_CHECK(thrown);
+        STRESS_CHECK(skipped == 0);
+        STRESS_CHECK(independent == 1);
+    }
+
+    void testBadGraphs() {
+        ThreadPool pool(1);
+        TaskGraph graph;
+        int a = graph.addTask([] {});
+        int b = graph.addTask([] {}, {a});
+        graph.addDependency(b, a);
+        bool cycle = false;
+        try {
+            graph.run(pool);
+        }
+        catch (const std::logic_error&) {
+            cycle = true;
+        }
+        STRESS_CHECK(cycle);
+
+        bool bad_id = false;
+        try {
+            graph.addDependency(a, 42);
+        }
+        catch (const std::out_of_range&) {
+            bad_id = true;
+        }
+        STRESS_CHECK(bad_id);
+    }
+
+    void testShutDownPool(ThreadPool::Mode mode) {
+        ThreadPool pool(2, 100, mode);
+        pool.shutdownNow();
+        TaskGraph graph;
+        std::atomic<int> runs(0);
+        int a = graph.addTask([&runs] {
+            ++runs;
+        });
+        graph.addTask([&runs] {
+            ++runs;
+        }, {a});
+        bool broken = false;
+        try {
+            graph.run(pool);
+        }
+        catch (const std::future_error& error) {
+            broken = error.code() == std::future_errc::broken_promise;
+        }
+        STRESS_CHECK(broken);
+        STRESS_CHECK(runs == 0);
+
+        // It works again once the pool is restarted.
+        pool.start(2);
+        graph.run(pool);
+        STRESS_CHECK(runs == 2);
+    }
+
+    void testGroup(ThreadPool& pool) {
+        std::atomic<int> runs(0);
+        {
+            acht::TaskGroup group(pool);
+            for (int i = 0; i < 1000; ++i) {
+                group.run([&runs] {
+                    ++runs;
+                });
+            }
+            group.wait();
+            STRESS_CHECK(runs == 1000);
+            // Nested groups inside tasks must not starve the pool.
+            for (int i = 0; i < 8; ++i) {
+                group.run([&pool, &runs] {
+                    acht::TaskGroup inner(pool);
+                    for (int j = 0; j < 10; ++j) {
+                        inner.run([&runs] {
+                            ++runs;
+                        });
+                    }
+                    inner.wait();
+                });
+            }
+        }
+        STRESS_CHECK(runs == 1080);
+    }
+}
+
+int main() {
+    for (ThreadPool::Mode mode : {ThreadPool::Mode::SharedQueue, ThreadPool::Mode::WorkStealing}) {
+        ThreadPool pool(4, 100, mode);
+        testOrder(pool);
+        testFailure(pool);
+        testGroup(pool);
+        testShutDownPool(mode);
+    }
+    testBadGraphs();
+    return stress::result();
+}
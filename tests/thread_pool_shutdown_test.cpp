@@ -0,0 +1,123 @@
+/***********************************************************
+ *  Stress test of shutdownNow() and start() on ThreadPool:
+ *  other threads keep submitting tasks with and without
+ *  futures, tasks that submit tasks and timers while the pool
+ *  is shut down and restarted under them, in both modes. No
+ *  thread may hang, and every future must end up ready, with
+ *  either its value or a broken promise for a task that was
+ *  dropped. Meant to be run under ThreadSanitizer and
+ *  AddressSanitizer as well.
+ ***********************************************************/
+
+#include "StressUtil.hpp"
+#include "acht/ThreadPool.hpp"
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <future>
+
+namespace {
+
+    using acht::ThreadPool;
+
+    const int submitters = 2;
+    const int threads = 2;
+    const int max_tasks = 64;
+
+    void test(ThreadPool::Mode mode, const char* name, int rounds) {
+        std::atomic<bool> done(false);
+        std::atomic<long> submitted(0);
+        std::atomic<long> ran(0);
+        std::vector<std::vector<std::future<long>>> futures(submitters);
+        std::vector<std::thread> threads_submitting;
+        {
+            ThreadPool pool(threads, max_tasks, mode);
+            for (int s = 0; s < submitters; ++s) {
+                threads_submitting.emplace_back([&, s] {
+                    std::vector<std::future<long>>& mine = futures[s];
+                    for (long i = 0; !done; ++i) {
+                        switch (i % 5) {
+                            case 0:
+                                mine.push_back(pool.submit([i] {
+                                    return i;
+                                }));
+                                break;
+                            case 1:
+                                pool.submit(acht::UniqueTask([&ran] {
+                                    ++ran;
+                                }));
+                                ++submitted;
+                                break;
+                            case 2:
+                                if (pool.trySubmit(acht::UniqueTask([&ran] {
+                                    ++ran;
+                                }))) {
+                                    ++submitted;
+                                }
+                                break;
+                            case 3:
+                                // A task that submits a task, which goes to
+                                // the worker's own deque in work-stealing mode.
+                                pool.submit(acht::UniqueTask([&pool, &ran, &submitted] {
+                                    ++ran;
+                                    ++submitted;
+                                    pool.submit(acht::UniqueTask([&ran] {
+                                        ++ran;
+                                    }));
+                                }));
+                                ++submitted;
+                                break;
+                            default:
+                                if (pool.scheduleAfter(std::chrono::milliseconds(1), [&ran] {
+                                    ++ran;
+                                }).isValid()) {
+                                    ++submitted;
+                                }
+                                break;
+                        }
+                    }
+                });
+            }
+
+            for (int i = 0; i < rounds; ++i) {
+                stress::sleepMicros(500 + (i * 7919) % 3000);
+                pool.shutdownNow();
+                STRESS_CHECK(pool.getThreadCount() == 0);
+                stress::sleepMicros(100);
+                pool.start(threads, max_tasks);
+                STRESS_CHECK(pool.getThreadCount() == threads);
+            }
+            done = true;
+            for (auto& thread : threads_submitting) {
+                thread.join();
+            }
+            // The pool is destroyed here, dropping what is still queued.
+        }
+
+        long values = 0;
+        long broken = 0;
+        for (int s = 0; s < submitters; ++s) {
+            for (auto& future : futures[s]) {
+                STRESS_CHECK(future.wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+                try {
+                    future.get();
+                    ++values;
+                }
+                catch (const std::future_error& error) {
+                    STRESS_CHECK(error.code() == std::future_errc::broken_promise);
+                    ++broken;
+                }
+            }
+        }
+        STRESS_CHECK(ran <= submitted);
+        std::printf("%s: %d rounds, %ld of %ld tasks ran, %ld futures with a value, %ld broken\n",
+                    name, rounds, ran.load(), submitted.load(), values, broken);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    int rounds = stress::rounds(argc, argv, 30);
+    test(ThreadPool::Mode::SharedQueue, "SharedQueue", rounds);
+    test(ThreadPool::Mode::WorkStealing, "WorkStealing", rounds);
+    return stress::result();
+}
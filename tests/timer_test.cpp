@@ -0,0 +1,150 @@
+/***********************************************************
+ *  Tests of TimerWheel and of the timers of ThreadPool. The
+ *  wheel is driven with made-up times, so that timers on every
+ *  level (up to minutes away) are checked to fire on time and
+ *  never early; the pool is checked with real, short delays.
+ ***********************************************************/
+
+#include "StressUtil.hpp"
+#include "acht/ThreadPool.hpp"
+#include "acht/TimerWheel.hpp"
+#include <atomic>
+#include <vector>
+
+namespace {
+
+    using acht::TimerWheel;
+    using Clock = TimerWheel::Clock;
+    using std::chrono::milliseconds;
+
+    // Advance the wheel in 1 ms steps from "from" to "to" after "base" and run what is due.
+    void advance(TimerWheel& wheel, Clock::time_point base, long from, long to) {
+        std::vector<acht::UniqueTask> due;
+        for (long t = from; t <= to; ++t) {
+            wheel.advance(base + milliseconds(t), due);
+            for (auto& task : due) {
+                task();
+            }
+            due.clear();
+        }
+    }
+
+    void testDeadlines() {
+        TimerWheel wheel;
+        Clock::time_point base = Clock::now();
+        // On level 0, level 1, level 2 and level 3
+        long delays[] = {5, 63, 64, 100, 4097, 300000};
+        long now = 0;
+        std::vector<long> fired(sizeof(delays) / sizeof(delays[0]), -1);
+        for (std::size_t i = 0; i < fired.size(); ++i) {
+            wheel.add(base + milliseconds(delays[i]), acht::UniqueTask([&fired, &now, i] {
+                fired[i] = now;
+            }));
+        }
+        STRESS_CHECK(wheel.getSize() == static_cast<int>(fired.size()));
+        std::vector<acht::UniqueTask> due;
+        for (now = 0; now <= 301000; ++now) {
+            wheel.advance(base + milliseconds(now), due);
+            for (auto& task : due) {
+                task();
+            }
+            due.clear();
+        }
+        for (std::size_t i = 0; i < fired.size(); ++i) {
+            // Deadlines are rounded up to a whole tick after the wheel's origin.
+            STRESS_CHECK(fired[i] >= delays[i] && fired[i] <= delays[i] + 1);
+        }
+        STRESS_CHECK(wheel.getSize() == 0);
+        STRESS_CHECK(wheel.nextWake() == Clock::time_point::max());
+    }
+
+    void testCancel() {
+        TimerWheel wheel;
+        Clock::time_point base = Clock::now();
+        int runs = 0;
+        acht::TimerHandle handle = wheel.add(base + milliseconds(10), acht::UniqueTask([&runs] {
+            ++runs;
+        }));
+        STRESS_CHECK(handle.isValid());
+        STRESS_CHECK(wheel.cancel(handle));
+        STRESS_CHECK(!wheel.cancel(handle));
+        STRESS_CHECK(wheel.getSize() == 0);
+        advance(wheel, base, 0, 20);
+        STRESS_CHECK(runs == 0);
+
+        // A stale handle does not cancel the timer that reuses its slot.
+        acht::TimerHandle fired = wheel.add(base + milliseconds(25), acht::UniqueTask([&runs] {
+            ++runs;
+        }));
+        advance(wheel, base, 21, 30);
+        STRESS_CHECK(runs == 1);
+        wheel.add(base + milliseconds(40), acht::UniqueTask([&runs] {
+            ++runs;
+        }));
+        STRESS_CHECK(!wheel.cancel(fired));
+        advance(wheel, base, 31, 50);
+        STRESS_CHECK(runs == 2);
+    }
+
+    void testPeriodic() {
+        TimerWheel wheel;
+        Clock::time_point base = Clock::now();
+        int runs = 0;
+        acht::TimerHandle handle = wheel.add(base + milliseconds(10), acht::UniqueTask([&runs] {
+            ++runs;
+        }), milliseconds(10));
+        advance(wheel, base, 0, 105);
+        STRESS_CHECK(runs == 10);
+        STRESS_CHECK(wheel.cancel(handle));
+        advance(wheel, base, 106, 200);
+        STRESS_CHECK(runs == 10);
+    }
+
+    void testPool() {
+        acht::ThreadPool pool(2);
+        std::atomic<int> once(0);
+        std::atomic<int> cancelled(0);
+        std::atomic<int> periodic(0);
+        std::atomic<long long> fired_at(0);
+
+        Clock::time_point start = Clock::now();
+        pool.scheduleAfter(milliseconds(20), [&] {
+            fired_at = (Clock::now() - start).count();
+            ++once;
+        });
+        acht::TimerHandle never = pool.scheduleAfter(milliseconds(30), [&] {
+            ++cancelled;
+        });
+        acht::TimerHandle every = pool.scheduleEvery(milliseconds(5), [&] {
+            ++periodic;
+        });
+        STRESS_CHECK(pool.getTimerCount() == 3);
+        STRESS_CHECK(pool.cancel(never));
+
+        std::this_thread::sleep_for(milliseconds(100));
+        STRESS_CHECK(once == 1);
+        STRESS_CHECK(Clock::duration(fired_at.load()) >= milliseconds(20));
+        STRESS_CHECK(cancelled == 0);
+        STRESS_CHECK(periodic >= 3);
+        STRESS_CHECK(pool.cancel(every));
+        STRESS_CHECK(pool.getTimerCount() == 0);
+
+        // At most a run that was already handed out follows the cancel.
+        std::this_thread::sleep_for(milliseconds(10));
+        int runs = periodic;
+        std::this_thread::sleep_for(milliseconds(30));
+        STRESS_CHECK(periodic == runs);
+
+        // A shut down pool takes no timers.
+        pool.shutdownNow();
+        STRESS_CHECK(!pool.scheduleAfter(milliseconds(1), [] {}).isValid());
+    }
+}
+
+int main() {
+    testDeadlines();
+    testCancel();
+    testPeriodic();
+    testPool();
+    return stress::result();
+}
@@ -0,0 +1,113 @@
+/***********************************************************
+ *  Print binary log files (see acht/BinaryLog.hpp) as text,
+ *  the same lines the logger writes to a text log file.
+ *
+ *  Usage: acht_logcat [-l LEVEL] [-g TEXT] [FILE...]
+ *
+ *  -l LEVEL  only print records at least as severe as LEVEL
+ *  -g TEXT   only print lines containing TEXT
+ *
+ *  Reads the standard input if no file is given. Times are
+ *  printed in the local time zone of this machine.
+ ***********************************************************/
+
+#include "acht/BinaryLog.hpp"
+#include <string>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+    struct Options {
+        std::uint32_t level = static_cast<std::uint32_t>(acht::LogLevel::DEBUG);
+        std::string pattern;
+    };
+
+    /***********************************************************
+     *  Print the records of one file. Return false if it is not
+     *  a binary log file or ends in the middle of an entry.
+     ***********************************************************/
+    bool printFile(std::FILE* file, const char* name, const Options& options) {
+        acht::BinaryLogDecoder decoder;
+        acht::LogTimeFormat time_format;
+        acht::BinaryLogDecoder::Record record;
+        std::string line;
+        char chunk[64 * 1024];
+        std::size_t size;
+        while ((size = std::fread(chunk, 1, sizeof(chunk), file)) > 0) {
+            decoder.feed(chunk, size);
+            acht::BinaryLogDecoder::Status status;
+            while ((status = decoder.next(record)) == acht::BinaryLogDecoder::Status::Record) {
+                if (record.level > options.level) {
+                    continue;
+                }
+                line.clear();
+                acht::appendLogLine(line, time_format, record.level_name, record.time,
+                                    record.format, record.args, record.size);
+                if (options.pattern.empty() || line.find(options.pattern) != std::string::npos) {
+                    std::fwrite(line.data(), 1, line.size(), stdout);
+                }
+            }
+            if (status == acht::BinaryLogDecoder::Status::Corrupt) {
+                std::fprintf(stderr, "acht_logcat: %s: not a binary log file or corrupt\n", name);
+                return false;
+            }
+        }
+        if (decoder.hasPartialEntry()) {
+            std::fprintf(stderr, "acht_logcat: %s: ends in the middle of a record\n", name);
+            return false;
+        }
+        return true;
+    }
+
+    bool parseLevel(const char* name, std::uint32_t& level) {
+        for (std::uint32_t i = 0; i <= static_cast<std::uint32_t>(acht::LogLevel::DEBUG); ++i) {
+            if (std::strcmp(name, acht::logLevelName(static_cast<acht::LogLevel>(i))) == 0) {
+                level = i;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    int usage() {
+        std::fprintf(stderr, "usage: acht_logcat [-l FATAL|ERROR|WARN|INFO|DEBUG] [-g TEXT] [FILE...]\n");
+        return 2;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-' && argv[arg][1] != '\0'; ++arg) {
+        if (std::strcmp(argv[arg], "-l") == 0 && arg + 1 < argc) {
+            if (!parseLevel(argv[++arg], options.level)) {
+                return usage();
+            }
+        }
+        else if (std::strcmp(argv[arg], "-g") == 0 && arg + 1 < argc) {
+            options.pattern = argv[++arg];
+        }
+        else {
+            return usage();
+        }
+    }
+
+    bool ok = true;
+    if (arg == argc) {
+        ok = printFile(stdin, "-", options);
+    }
+    for (; arg < argc; ++arg) {
+        std::FILE* file = std::strcmp(argv[arg], "-") == 0 ? stdin : std::fopen(argv[arg], "rb");
+        if (file == nullptr) {
+            std::fprintf(stderr, "acht_logcat: %s: cannot open\n", argv[arg]);
+            ok = false;
+            continue;
+        }
+        ok = printFile(file, argv[arg], options) && ok;
+        if (file != stdin) {
+            std::fclose(file);
+        }
+    }
+    return ok ? 0 : 1;
+}